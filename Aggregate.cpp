@@ -0,0 +1,114 @@
+/* copyright caohd 2023
+ * Implementation of the aggregates that can be used in the select list of
+ * a query.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include "Aggregate.h"
+#include "OrderBy.h"
+#include "WhereExpr.h"
+
+// Format a number for printing in the results. Integral values are
+// printed without a fractional part.
+static std::string toString(const double num) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", num);
+    return buf;
+}
+
+bool
+AggSpec::toFunc(const std::string& name, Func& func) {
+    if (name == "count")     func = Func::COUNT;
+    else if (name == "sum")  func = Func::SUM;
+    else if (name == "avg")  func = Func::AVG;
+    else if (name == "min")  func = Func::MIN;
+    else if (name == "max")  func = Func::MAX;
+    else return false;
+    return true;
+}
+
+void
+AggState::add(const AggSpec& spec, const CSV& csv, const int* sel,
+        const int selCount) {
+    if (spec.colIdx == -1) {
+        count += selCount;  // count(*) does not need to look at the rows
+        return;
+    }
+    for (int i = 0; i < selCount; i++) {
+        add(spec, csv[sel[i]][spec.colIdx]);
+    }
+}
+
+void
+AggState::add(const AggSpec& spec, const std::string& value) {
+    if (value.empty()) {
+        return;
+    }
+    count++;
+    if (spec.func == AggSpec::Func::COUNT) {
+        return;
+    }
+    const double num = WhereExpr::toNumber(value);
+    if (spec.func == AggSpec::Func::SUM || spec.func == AggSpec::Func::AVG) {
+        if (!std::isnan(num)) {
+            sum += num;
+            numCount++;
+        }
+        return;
+    }
+    // Here the aggregate is min or max
+    const int cmp = (count == 1 ? 0 : RowOrder::compare(value, num, best,
+        bestNum));
+    if (count == 1 || (spec.func == AggSpec::Func::MIN ? cmp < 0 : cmp > 0)) {
+        best    = value;
+        bestNum = num;
+    }
+}
+
+void
+AggState::remove(const AggSpec& spec, const CSVRow& row) {
+    const std::string& value = (spec.colIdx == -1 ? "*" : row[spec.colIdx]);
+    if (value.empty()) {
+        return;
+    }
+    count--;
+    const double num = WhereExpr::toNumber(value);
+    if (spec.func != AggSpec::Func::COUNT && !std::isnan(num)) {
+        sum -= num;
+        numCount--;
+    }
+}
+
+void
+AggState::merge(const AggSpec& spec, const AggState& other) {
+    if (other.count == 0) {
+        return;
+    }
+    if ((spec.func == AggSpec::Func::MIN || spec.func == AggSpec::Func::MAX)
+        && count != 0) {
+        const int cmp = RowOrder::compare(other.best, other.bestNum, best,
+            bestNum);
+        if (spec.func == AggSpec::Func::MIN ? cmp < 0 : cmp > 0) {
+            best    = other.best;
+            bestNum = other.bestNum;
+        }
+    } else {
+        best    = other.best;
+        bestNum = other.bestNum;
+    }
+    count    += other.count;
+    numCount += other.numCount;
+    sum      += other.sum;
+}
+
+std::string
+AggState::result(const AggSpec& spec) const {
+    switch (spec.func) {
+    case AggSpec::Func::COUNT: return std::to_string(count);
+    case AggSpec::Func::SUM:   return toString(sum);
+    case AggSpec::Func::AVG:   return (numCount == 0 ? "" :
+            toString(sum / numCount));
+    default:                   return best;
+    }
+}
@@ -0,0 +1,188 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+/*
+ * Aggregates that can be used in the select list of a query, optionally
+ * along with a group by clause, for example:
+ *
+ *     select count(*), avg(rating), max(year) from test.csv;
+ *     select country, count(*) from airports.csv group by country;
+ *
+ * Each thread scanning a part of a CSV computes a partial aggregate (or a
+ * hash table of partial aggregates, one per group) and the partial
+ * aggregates are merged once all the parts have been scanned. Rows are
+ * never formatted for such queries.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "CSV.h"
+
+/**
+ * An aggregate in the select list of a query, i.e., a function applied to
+ * a column (or to "*" in the case of count).
+ */
+class AggSpec {
+public:
+    /**
+     * The aggregate functions that are supported. VALUE is not really an
+     * aggregate. It is a column in the group by clause that is printed
+     * as-is and is not computed via AggState.
+     */
+    enum class Func { COUNT, SUM, AVG, MIN, MAX, VALUE };
+
+    /**
+     * Create an aggregate.
+     *
+     * @param func The aggregate function.
+     *
+     * @param colIdx The index of the column to be aggregated. It is -1
+     * for count(*). For VALUE, it is the index of the column in the list
+     * of group by columns.
+     */
+    AggSpec(const Func func, const int colIdx) : func(func), colIdx(colIdx) {}
+
+    /**
+     * Convert the name of an aggregate function in a query to the
+     * corresponding enumeration.
+     *
+     * @param name The name of the function, e.g., "count" or "avg".
+     *
+     * @param func The enumeration corresponding to the name.
+     *
+     * @return This method returns true if the name is an aggregate
+     * function.
+     */
+    static bool toFunc(const std::string& name, Func& func);
+
+    /** The aggregate function */
+    Func func;
+
+    /** The index of the column to be aggregated, or -1 for count(*).
+     * For VALUE, it is the index of the column in the group by clause.
+     */
+    int colIdx;
+};
+
+/**
+ * The (partial) result of an aggregate. Values that are not numbers are
+ * ignored by sum and avg, while min and max compare values in the same
+ * type-aware manner as order by. Empty values are ignored by all the
+ * aggregates other than count(*).
+ */
+class AggState {
+public:
+    /**
+     * Add the values from a set of selected rows to this aggregate.
+     *
+     * @note The caller must hold the mutexes of all the rows in sel.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @param csv The CSV from which rows have been selected.
+     *
+     * @param sel The indices of the selected rows in the CSV.
+     *
+     * @param selCount The number of entries in sel.
+     */
+    void add(const AggSpec& spec, const CSV& csv, const int* sel,
+        const int selCount);
+
+    /**
+     * Add the value from a single selected row to this aggregate.
+     *
+     * @note The caller must hold the mutex of the row.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @param row The selected row.
+     */
+    void add(const AggSpec& spec, const CSVRow& row) {
+        if (spec.colIdx == -1) {
+            count++;
+        } else {
+            add(spec, row[spec.colIdx]);
+        }
+    }
+
+    /**
+     * Add a single value to this aggregate.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @param value The value to be added.
+     */
+    void add(const AggSpec& spec, const std::string& value);
+
+    /**
+     * Remove the value from a row that was earlier added to this
+     * aggregate. Only count, sum, and avg support removal.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @param row The row whose value is to be removed.
+     */
+    void remove(const AggSpec& spec, const CSVRow& row);
+
+    /**
+     * Merge a partial aggregate computed by another thread into this one.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @param other The partial aggregate to be merged.
+     */
+    void merge(const AggSpec& spec, const AggState& other);
+
+    /**
+     * Obtain the final value of this aggregate as printed in the results.
+     *
+     * @param spec The aggregate being computed.
+     *
+     * @return The value of the aggregate. It is an empty string for avg,
+     * min, and max if there were no values.
+     */
+    std::string result(const AggSpec& spec) const;
+
+private:
+    /** The number of values (or rows, for count(*)) aggregated */
+    long count = 0;
+
+    /** The number of values that were numbers */
+    long numCount = 0;
+
+    /** The sum of the values that were numbers */
+    double sum = 0;
+
+    /** The current minimum or maximum value, if count is not zero */
+    std::string best;
+
+    /** The current minimum or maximum value as a number, or NaN */
+    double bestNum = 0;
+};
+
+/**
+ * The (partial) aggregates of one group in a query with a group by clause.
+ */
+struct AggGroup {
+    /** The index of the first row in the CSV that is in this group. It
+     * is used to print groups in the order in which they appear.
+     */
+    int firstRow;
+
+    /** The values of the group by columns for this group */
+    StrVec keys;
+
+    /** The partial result of each aggregate in the select list */
+    std::vector<AggState> states;
+};
+
+/**
+ * A hash table of groups. The key is the values of the group by columns
+ * separated by a '\0' character.
+ */
+using AggTable = std::unordered_map<std::string, AggGroup>;
+
+#endif /* AGGREGATE_H */
@@ -0,0 +1,341 @@
+/* copyright caohd 2023
+ * Implementation of the asynchronous web-server built on Boost.Asio.
+ */
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <condition_variable>
+#include "AsyncServer.h"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+// The response to the request whose handler is run by the current thread
+static thread_local std::shared_ptr<AsyncServer::Response> currentResponse;
+
+/**
+ * A connection from a client. The request headers are read asynchronously
+ * on the strand of the connection. The handler then runs on a compute
+ * thread and writes the response to this object, which is a stream buffer.
+ * Each full buffer is handed to the strand, which writes the buffers to
+ * the socket asynchronously and in order.
+ */
+class AsyncServer::Connection : public std::streambuf,
+    public std::enable_shared_from_this<Connection> {
+public:
+    /** The size of the buffer in which the response is accumulated */
+    static constexpr size_t BufferSize = 16 * 1024;
+
+    explicit Connection(AsyncServer& server) : server(server),
+        socket(server.ioContext), strand(asio::make_strand(server.ioContext)),
+        timer(strand) {
+        setBuffer();
+    }
+
+    /** The socket on which the connection is accepted */
+    tcp::socket& getSocket() { return socket; }
+
+    /** Run a task that continues the response once the handler and the
+     * earlier tasks have returned. See Response::resume().
+     */
+    void resume(std::function<void()> task) {
+        {
+            std::scoped_lock<std::mutex> g(taskMutex);
+            if (running) {
+                pendingTasks.push_back(std::move(task));
+                return;
+            }
+            running = true;
+        }
+        runTask(std::move(task));
+    }
+
+    /** Close the connection once the pending writes are done. This is
+     * called once the whole response has been written to this object.
+     */
+    void finish() {
+        auto self = shared_from_this();
+        asio::post(strand, [self] {
+            self->closing = true;
+            if (self->writeQueue.empty()) {
+                self->close();
+            }
+        });
+    }
+
+    /** Read the request headers and then hand the request to a compute
+     * thread. Clients that do not send the headers in time are dropped.
+     */
+    void start() {
+        auto self = shared_from_this();
+        timer.expires_after(std::chrono::milliseconds(HeaderTimeoutMs));
+        timer.async_wait([self](const boost::system::error_code& ec) {
+            if (!ec) {
+                self->close();
+            }
+        });
+        asio::async_read_until(socket, request, "\r\n\r\n",
+            asio::bind_executor(strand, [self](
+                const boost::system::error_code& ec, size_t) {
+                self->timer.cancel();
+                if (ec) {
+                    self->close();
+                } else {
+                    self->server.computePool.submit([self] {
+                        self->process();
+                    });
+                }
+            }));
+    }
+
+protected:
+    // Write out the full buffer and then store the character
+    int_type overflow(int_type ch) override {
+        flushBuffer();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return (isFailed() ? traits_type::eof() : traits_type::not_eof(ch));
+    }
+
+    // Write out the buffered data
+    int sync() override {
+        flushBuffer();
+        return (isFailed() ? -1 : 0);
+    }
+
+private:
+    /** Run the handler on the request. This runs on a compute thread */
+    void process() {
+        auto response = std::make_shared<Response>(shared_from_this());
+        currentResponse = response;
+        std::istream is(&request);
+        server.handler(is, response->getStream());
+        currentResponse.reset();
+        // The connection is closed once the response is no longer used
+        response.reset();
+        taskDone();
+    }
+
+    /** Run a task on a compute thread, followed by the pending tasks */
+    void runTask(std::function<void()> task) {
+        auto self = shared_from_this();
+        server.computePool.submit([self, task = std::move(task)] {
+            task();
+            self->taskDone();
+        });
+    }
+
+    /** Start the next pending task, if any, once a task has returned */
+    void taskDone() {
+        std::function<void()> task;
+        {
+            std::scoped_lock<std::mutex> g(taskMutex);
+            if (pendingTasks.empty()) {
+                running = false;
+                return;
+            }
+            task = std::move(pendingTasks.front());
+            pendingTasks.pop_front();
+        }
+        runTask(std::move(task));
+    }
+
+    /** Start a new buffer for the response */
+    void setBuffer() {
+        buffer.resize(BufferSize);
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    /** Check if writes to the client have failed */
+    bool isFailed() {
+        std::scoped_lock<std::mutex> g(writeMutex);
+        return failed;
+    }
+
+    /** Hand the buffered data to the strand to be written. This method
+     * blocks the compute thread while too much data is pending.
+     */
+    void flushBuffer() {
+        const size_t size = pptr() - pbase();
+        if (size == 0) {
+            return;
+        }
+        buffer.resize(size);
+        {
+            std::unique_lock<std::mutex> lock(writeMutex);
+            writeCond.wait(lock, [this] {
+                return failed || pending < MaxPendingBytes; });
+            if (failed) {
+                setBuffer();  // Discard the data
+                return;
+            }
+            pending += size;
+        }
+        auto self = shared_from_this();
+        asio::post(strand, [self, data = std::move(buffer)]() mutable {
+            self->writeQueue.push_back(std::move(data));
+            if (self->writeQueue.size() == 1) {
+                self->writeNext();
+            }
+        });
+        buffer = std::vector<char>();
+        setBuffer();
+    }
+
+    /** Write the buffer at the front of the queue. This runs on the
+     * strand, which owns writeQueue.
+     */
+    void writeNext() {
+        auto self = shared_from_this();
+        asio::async_write(socket, asio::buffer(writeQueue.front()),
+            asio::bind_executor(strand, [self](
+                const boost::system::error_code& ec, size_t) {
+                {
+                    std::scoped_lock<std::mutex> g(self->writeMutex);
+                    self->pending -= self->writeQueue.front().size();
+                    self->failed = self->failed || ec;
+                }
+                self->writeCond.notify_all();
+                self->writeQueue.pop_front();
+                if (ec) {
+                    self->writeQueue.clear();
+                    self->close();
+                } else if (!self->writeQueue.empty()) {
+                    self->writeNext();
+                } else if (self->closing) {
+                    self->close();
+                }
+            }));
+    }
+
+    /** Close the socket. This runs on the strand */
+    void close() {
+        boost::system::error_code ec;
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+        socket.close(ec);
+    }
+
+    /** The server that accepted this connection */
+    AsyncServer& server;
+
+    /** The socket connected to the client */
+    tcp::socket socket;
+
+    /** The strand on which all the I/O of this connection runs */
+    asio::strand<asio::io_context::executor_type> strand;
+
+    /** The timer that limits the time taken to send the request */
+    asio::steady_timer timer;
+
+    /** The request line and headers read from the client */
+    asio::streambuf request;
+
+    /** The buffer in which the compute thread accumulates the response */
+    std::vector<char> buffer;
+
+    /** The buffers waiting to be written, owned by the strand */
+    std::deque<std::vector<char>> writeQueue;
+
+    /** Flag set on the strand once the whole response has been queued */
+    bool closing = false;
+
+    /** The mutex to protect pending and failed */
+    std::mutex writeMutex;
+
+    /** The condition variable on which the compute thread waits while
+     * too much of the response is pending.
+     */
+    std::condition_variable writeCond;
+
+    /** The number of bytes handed to the strand but not yet written */
+    size_t pending = 0;
+
+    /** Flag set if writing to the client failed */
+    bool failed = false;
+
+    /** The mutex to protect running and pendingTasks */
+    std::mutex taskMutex;
+
+    /** Flag set while the handler or a task of the response is running */
+    bool running = true;
+
+    /** The tasks resumed while the handler or another task was running */
+    std::deque<std::function<void()>> pendingTasks;
+};
+
+AsyncServer::Response::Response(std::shared_ptr<Connection> conn) :
+    conn(std::move(conn)), os(this->conn.get()) {
+}
+
+AsyncServer::Response::~Response() {
+    os.flush();
+    conn->finish();
+}
+
+void
+AsyncServer::Response::resume(std::function<void()> task) {
+    conn->resume(std::move(task));
+}
+
+std::shared_ptr<AsyncServer::Response>
+AsyncServer::getResponse() {
+    return currentResponse;
+}
+
+AsyncServer::AsyncServer(tcp::acceptor& acceptor, ThreadPool& computePool,
+        Handler handler) : ioContext(static_cast<asio::io_context&>(
+        acceptor.get_executor().context())), acceptor(acceptor),
+        computePool(computePool), handler(std::move(handler)),
+        acceptTimer(ioContext) {
+}
+
+void
+AsyncServer::accept() {
+    auto conn = std::make_shared<Connection>(*this);
+    acceptor.async_accept(conn->getSocket(),
+        [this, conn](const boost::system::error_code& ec) {
+            if (ec) {
+                retryAccept(ec);
+                return;
+            }
+            conn->start();
+            accept();
+        });
+}
+
+void
+AsyncServer::retryAccept(const boost::system::error_code& ec) {
+    if (ec == asio::error::operation_aborted) {
+        return;  // The acceptor was closed
+    }
+    // Errors such as running out of file descriptors last until some
+    // connections are closed. So do not spin on them.
+    std::cerr << "Error accepting connection: " << ec.message() << '\n';
+    acceptTimer.expires_after(std::chrono::milliseconds(AcceptRetryMs));
+    acceptTimer.async_wait([this](const boost::system::error_code& err) {
+        if (!err) {
+            accept();
+        }
+    });
+}
+
+void
+AsyncServer::run(const int ioThreads) {
+    accept();
+    std::vector<std::thread> threads;
+    for (int i = 1; i < ioThreads; i++) {
+        threads.emplace_back([this] { ioContext.run(); });
+    }
+    ioContext.run();
+    for (auto& thr : threads) {
+        thr.join();
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef ASYNC_SERVER_H
+#define ASYNC_SERVER_H
+
+/*
+ * An asynchronous web-server built on Boost.Asio. Connections are accepted
+ * and their requests are read by a few I/O threads without blocking, so
+ * idle and slow clients do not hold a thread each. Once a request has been
+ * read, it is processed by a pool of compute threads, whose output is
+ * written back to the client asynchronously by the I/O threads. A request
+ * that has to wait (e.g., for an update) can keep its response open and
+ * release its compute thread, and be resumed later by another task.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <istream>
+#include <ostream>
+#include "ThreadPool.h"
+
+/**
+ * A server that accepts connections on an acceptor and runs a handler for
+ * each request. The I/O completion handlers of each connection run on its
+ * own strand, so they never run concurrently even though multiple threads
+ * run the io_context of the acceptor.
+ */
+class AsyncServer {
+public:
+    /**
+     * The function that processes a request. It is given a stream with
+     * the request line and headers, and a stream to write the response
+     * to. It is run by a compute thread and may block.
+     */
+    using Handler = std::function<void(std::istream&, std::ostream&)>;
+
+    /** A connection from a client, defined in AsyncServer.cpp */
+    class Connection;
+
+    /**
+     * The response to a request. The connection is closed once the
+     * handler has returned and the last reference to the response is
+     * dropped. So a handler keeps the response open after it returns by
+     * keeping a reference, e.g., in a task that is resumed later.
+     */
+    class Response {
+    public:
+        /**
+         * Create the response to the request on a connection.
+         *
+         * @param conn The connection on which the request was read.
+         */
+        explicit Response(std::shared_ptr<Connection> conn);
+
+        /** Flush the stream and close the connection once the data has
+         * been written.
+         */
+        ~Response();
+
+        /**
+         * Obtain the stream to where the response is written. Only the
+         * handler and the tasks resumed by it may write to the stream.
+         *
+         * @return The stream that was given to the handler.
+         */
+        std::ostream& getStream() { return os; }
+
+        /**
+         * Run a task that continues the response on a compute thread. The
+         * task starts only once the handler and any earlier tasks of this
+         * response have returned, so they never write concurrently. This
+         * method does not block.
+         *
+         * @param task The task to be run.
+         */
+        void resume(std::function<void()> task);
+
+    private:
+        /** The connection on which the request was read */
+        const std::shared_ptr<Connection> conn;
+
+        /** The stream that writes to the connection */
+        std::ostream os;
+    };
+
+    /**
+     * Obtain the response to the request whose handler is being run by
+     * the calling thread.
+     *
+     * @return The response, or nullptr if the calling thread is not
+     * running the handler of an AsyncServer.
+     */
+    static std::shared_ptr<Response> getResponse();
+
+    /**
+     * The number of milliseconds a client has to send the headers of its
+     * request before the connection is closed.
+     */
+    static constexpr int HeaderTimeoutMs = 30000;
+
+    /**
+     * The maximum number of bytes of a response waiting to be written to
+     * a client. The compute thread producing the response blocks once this
+     * limit is reached, so that slow clients do not buffer whole results.
+     */
+    static constexpr size_t MaxPendingBytes = 256 * 1024;
+
+    /**
+     * The number of milliseconds to wait before accepting connections
+     * again after accepting one failed (e.g., when the process has run
+     * out of file descriptors).
+     */
+    static constexpr int AcceptRetryMs = 100;
+
+    /**
+     * Create the server.
+     *
+     * @param acceptor The acceptor on which connections are accepted. Its
+     * io_context is run by the I/O threads.
+     *
+     * @param computePool The pool of threads that run the handler. Its
+     * queue must not be bounded, as the I/O threads must never block.
+     *
+     * @param handler The function that processes each request.
+     */
+    AsyncServer(boost::asio::ip::tcp::acceptor& acceptor,
+        ThreadPool& computePool, Handler handler);
+
+    /**
+     * Accept and process connections forever.
+     *
+     * @param ioThreads The number of threads (including the calling
+     * thread) that run the io_context of the acceptor.
+     */
+    void run(const int ioThreads);
+
+private:
+    /** Start accepting the next connection */
+    void accept();
+
+    /**
+     * Log an error in accepting a connection and start accepting again
+     * after AcceptRetryMs, rather than retrying (and failing) at once.
+     *
+     * @param ec The error returned by the acceptor.
+     */
+    void retryAccept(const boost::system::error_code& ec);
+
+    /** The io_context of the acceptor */
+    boost::asio::io_context& ioContext;
+
+    /** The acceptor on which connections are accepted */
+    boost::asio::ip::tcp::acceptor& acceptor;
+
+    /** The pool of threads that run the handler */
+    ThreadPool& computePool;
+
+    /** The function that processes each request */
+    const Handler handler;
+
+    /** The timer that delays accepting again after an error */
+    boost::asio::steady_timer acceptTimer;
+};
+
+#endif /* ASYNC_SERVER_H */
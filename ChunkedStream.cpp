@@ -0,0 +1,187 @@
+/* copyright caohd 2023
+ * Implementation of the stream buffer that writes data using the HTTP/1.1
+ * chunked transfer encoding.
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include "ChunkedStream.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+// The buffers of finished responses that are reused by new responses
+static std::mutex poolMutex;
+static std::vector<std::vector<char>> bufferPool;
+
+// The maximum number of buffers kept in bufferPool
+static constexpr size_t MaxPooledBuffers = 64;
+
+ChunkedStreamBuf::ChunkedStreamBuf(std::ostream& os, const int fd,
+        std::string header) : os(os), fd(fd), header(std::move(header)) {
+    {
+        Guard g(poolMutex);
+        if (!bufferPool.empty()) {
+            buffer = std::move(bufferPool.back());
+            bufferPool.pop_back();
+        }
+    }
+    buffer.resize(BufferSize);
+    setp(buffer.data(), buffer.data() + buffer.size());
+    if (fd != -1) {
+        os.flush();  // Send the headers before writing to the socket
+    }
+}
+
+ChunkedStreamBuf::~ChunkedStreamBuf() {
+    Guard g(poolMutex);
+    if (buffer.size() == BufferSize && bufferPool.size() < MaxPooledBuffers) {
+        bufferPool.push_back(std::move(buffer));
+    }
+}
+
+void
+ChunkedStreamBuf::write(iovec* iov, int count) {
+    if (fd == -1) {
+        for (int i = 0; i < count; i++) {
+            os.write(static_cast<const char*>(iov[i].iov_base),
+                iov[i].iov_len);
+        }
+        return;
+    }
+    // The socket may be in non-blocking mode. So wait until it can be
+    // written to and resume after partial writes. Errors (e.g., the client
+    // disconnecting) just end the output. MSG_NOSIGNAL ensures that a
+    // disconnected client does not raise SIGPIPE.
+    while (!failed && count > 0) {
+        msghdr msg = {};
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = count;
+        const ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            pollfd pfd = {fd, POLLOUT, 0};
+            failed = ((errno != EAGAIN && errno != EWOULDBLOCK &&
+                errno != EINTR) || poll(&pfd, 1, -1) == -1);
+            continue;
+        }
+        // Skip over the buffers (and part of a buffer) that were written
+        size_t left = sent;
+        for (; count > 0 && left >= iov->iov_len; iov++, count--) {
+            left -= iov->iov_len;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+}
+
+void
+ChunkedStreamBuf::writeChunk(const char* data, const size_t len) {
+    const size_t buffered = pptr() - pbase();
+    if (buffered + len == 0) {
+        return;  // An empty chunk would end the response
+    }
+    char size[24];
+    const int sizeLen = snprintf(size, sizeof(size), "%zx\r\n",
+        buffered + len);
+    char trailer[] = "\r\n";
+    iovec iov[5];
+    int count = 0;
+    if (!header.empty()) {
+        // The response does not fit in the buffer. So it is chunked.
+        header += "Transfer-Encoding: chunked\r\n\r\n";
+        iov[count++] = {header.data(), header.size()};
+    }
+    iov[count++] = {size, size_t(sizeLen)};
+    if (buffered != 0) {
+        iov[count++] = {pbase(), buffered};
+    }
+    if (len != 0) {
+        iov[count++] = {const_cast<char*>(data), len};
+    }
+    iov[count++] = {trailer, 2};
+    write(iov, count);
+    header.clear();
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+bool
+ChunkedStreamBuf::reserve(const size_t n) {
+    const size_t buffered = pptr() - pbase();
+    if (header.empty() || buffered + n > MaxUnchunked) {
+        return false;
+    }
+    if (buffered + n > buffer.size()) {
+        buffer.resize(std::min(std::max(buffered + n, buffer.size() * 2),
+            MaxUnchunked));
+        setp(buffer.data(), buffer.data() + buffer.size());
+        pbump(buffered);
+    }
+    return true;
+}
+
+ChunkedStreamBuf::int_type
+ChunkedStreamBuf::overflow(int_type ch) {
+    if (!reserve(1)) {
+        writeChunk();
+    }
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return (os && !failed ? traits_type::not_eof(ch) : traits_type::eof());
+}
+
+std::streamsize
+ChunkedStreamBuf::xsputn(const char* s, std::streamsize n) {
+    // While the headers are pending, writes are buffered so that the
+    // response can still be sent with a Content-Length header.
+    if (size_t(n) < LargeWrite || reserve(n)) {
+        return std::streambuf::xsputn(s, n);
+    }
+    writeChunk(s, n);
+    return (os && !failed ? n : 0);
+}
+
+int
+ChunkedStreamBuf::sync() {
+    if (!header.empty()) {
+        return 0;  // Wait to see if the whole response fits in the buffer
+    }
+    writeChunk();
+    if (fd == -1) {
+        os.flush();
+    }
+    return (os && !failed ? 0 : -1);
+}
+
+void
+ChunkedStreamBuf::finish() {
+    if (!header.empty()) {
+        // The whole response is in the buffer
+        const size_t buffered = pptr() - pbase();
+        header += "Content-Length: " + std::to_string(buffered) +
+            "\r\n\r\n";
+        iovec iov[2] = {{header.data(), header.size()}, {pbase(), buffered}};
+        write(iov, buffered != 0 ? 2 : 1);
+        header.clear();
+        setp(buffer.data(), buffer.data() + buffer.size());
+        if (fd == -1) {
+            os.flush();
+        }
+        return;
+    }
+    writeChunk();
+    char last[] = "0\r\n\r\n";
+    iovec iov = {last, sizeof(last) - 1};
+    write(&iov, 1);
+    if (fd == -1) {
+        os.flush();
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef CHUNKED_STREAM_H
+#define CHUNKED_STREAM_H
+
+/*
+ * An output stream buffer that writes data to another stream using the
+ * HTTP/1.1 chunked transfer encoding. It is used to stream the results
+ * of queries to web-clients as the rows are produced, without having to
+ * know the length of the response up front. Responses of up to 1 MB are
+ * instead sent with a Content-Length header.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <sys/uio.h>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/**
+ * A stream buffer that collects small writes in a fixed-size buffer and
+ * writes it as a chunk each time the buffer is full or the stream is
+ * flushed. So at most one buffer of data is held in memory, regardless
+ * of the size of the response. Large writes (e.g., the rows of a morsel)
+ * are not copied into the buffer. Instead, the chunk size, the buffered
+ * data, the large block, and the chunk trailer are sent with a single
+ * scatter-gather write (sendmsg) on the socket. The buffers are pooled and
+ * reused across responses. While the headers of a response are pending,
+ * the buffer instead grows (up to MaxUnchunked) so that the response can
+ * be sent with a Content-Length header if it turns out to be small.
+ */
+class ChunkedStreamBuf : public std::streambuf {
+public:
+    /** The size of the buffer, i.e., the largest chunk of small writes */
+    static constexpr size_t BufferSize = 16 * 1024;
+
+    /**
+     * Writes of at least this many bytes are sent directly instead of
+     * being copied into the buffer.
+     */
+    static constexpr size_t LargeWrite = BufferSize / 4;
+
+    /**
+     * While the headers are pending, the buffer grows up to this size
+     * before the response is chunked.
+     */
+    static constexpr size_t MaxUnchunked = 1024 * 1024;
+
+    /**
+     * Create a stream buffer that writes chunks to a given stream.
+     *
+     * @param os The stream to where the chunks are written.
+     *
+     * @param fd An optional file descriptor of the socket underlying os.
+     * If specified, os is flushed once and the chunks are then written
+     * directly to the socket with scatter-gather writes.
+     *
+     * @param header The HTTP headers of the response, each ending with
+     * "\r\n" but without the blank line that ends them. They are sent
+     * with a Content-Length header if the whole response is at most
+     * MaxUnchunked bytes. Otherwise, they are sent with
+     * "Transfer-Encoding: chunked" once the buffer has grown to that
+     * size, and flushing the stream before that does not send anything.
+     * If header is empty, the headers (including "Transfer-Encoding:
+     * chunked") must already have been written to the stream.
+     */
+    explicit ChunkedStreamBuf(std::ostream& os, const int fd = -1,
+        std::string header = "");
+
+    /**
+     * Returns the buffer to the pool of buffers, unless it has grown.
+     */
+    ~ChunkedStreamBuf();
+
+    /**
+     * Write any buffered data followed by the last (empty) chunk that
+     * ends the response. Nothing can be written after this method has
+     * been called.
+     */
+    void finish();
+
+protected:
+    /** Write the full buffer as a chunk and then buffer the character */
+    int_type overflow(int_type ch) override;
+
+    /** Buffer small writes and send large writes directly */
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+    /** Write the buffered data as a chunk and flush the stream */
+    int sync() override;
+
+private:
+    /**
+     * Write the buffered data along with an optional block of data as a
+     * single chunk. Nothing is written if there is no data.
+     *
+     * @param data An optional block of data written after the buffered
+     * data.
+     *
+     * @param len The length of the block of data.
+     */
+    void writeChunk(const char* data = nullptr, const size_t len = 0);
+
+    /**
+     * Grow the buffer while the headers are pending, so that another n
+     * bytes can be buffered.
+     *
+     * @param n The number of bytes to be written.
+     *
+     * @return True if the bytes fit in the buffer, or false if the headers
+     * have been sent or the buffer would exceed MaxUnchunked.
+     */
+    bool reserve(const size_t n);
+
+    /**
+     * Write a sequence of buffers to the socket (if any) or the stream.
+     *
+     * @param iov The buffers to be written in order. They are modified
+     * to track partial writes.
+     *
+     * @param count The number of buffers.
+     */
+    void write(iovec* iov, int count);
+
+    /** The stream to where the chunks are written */
+    std::ostream& os;
+
+    /** The optional socket to where the chunks are written directly */
+    const int fd;
+
+    /** The buffer with the data for the next chunk */
+    std::vector<char> buffer;
+
+    /** Flag set once a write to the socket fails */
+    bool failed = false;
+
+    /** The headers of the response that have not been sent yet */
+    std::string header;
+};
+
+#endif /* CHUNKED_STREAM_H */
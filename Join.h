@@ -0,0 +1,81 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+/*
+ * A compiled form of a select query that joins two in-memory CSVs on an
+ * equality condition, for example:
+ *
+ *     select a.title, b.genre from a.csv join b.csv on a.id = b.movieid;
+ *
+ * Joins are processed as hash joins. The smaller CSV (the build side) is
+ * scanned once to build a hash table from its join column to the values
+ * of its columns in the select list. The larger CSV (the probe side) is
+ * then scanned in parallel, looking up each row in the hash table.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "QueryPlan.h"
+
+/**
+ * A plan for a join query. The columns and where clause for each of the
+ * two CSVs are held in a separate QueryPlan, so that each CSV can be
+ * scanned and filtered in the same manner as in a regular select query.
+ */
+class JoinPlan {
+public:
+    /**
+     * The position of a column in the select list of a join query.
+     */
+    struct OutCol {
+        /** The CSV (0 for the left, 1 for the right) with the column */
+        int side;
+
+        /** The index of the column in the colIdx of the side's plan */
+        int pos;
+    };
+
+    /**
+     * Create a plan from the plans for the two sides of a join.
+     *
+     * @param left The plan for the CSV before the "join" keyword.
+     *
+     * @param right The plan for the CSV after the "join" keyword.
+     */
+    JoinPlan(QueryPlan left, QueryPlan right) :
+        sides{std::move(left), std::move(right)} {}
+
+    /** The names of the columns in the select list */
+    StrVec colNames;
+
+    /** The source of each column in the select list */
+    std::vector<OutCol> outCols;
+
+    /** The plans with the columns and where clause for each side */
+    QueryPlan sides[2];
+
+    /** The index of the join column in each of the two CSVs */
+    int keyCol[2] = {-1, -1};
+
+    /** The maximum number of rows to be selected, or -1 for no limit */
+    int limit = -1;
+
+    /** The number of joined rows to be skipped before selecting rows */
+    int offset = 0;
+
+    /** The encoding in which joined rows are formatted */
+    ResultWriter::Encoding encoding = ResultWriter::Encoding::TSV;
+};
+
+/**
+ * The hash table built from the build side of a join. It maps each value
+ * of the join column to the values of the selected columns (in the order
+ * of the colIdx in the side's plan) of every row with that value. Values
+ * are copied so that the probe does not need to lock the rows again.
+ */
+using JoinTable = std::unordered_map<std::string, std::vector<StrVec>>;
+
+#endif /* JOIN_H */
@@ -0,0 +1,267 @@
+/* copyright caohd 2023
+ * Implementation of the SIMD kernels used to evaluate where clause
+ * conditions. The AVX-512 and AVX2 versions are compiled with target
+ * attributes so that no special compiler flags are needed. The version
+ * to be used is picked once, based on the features of the CPU.
+ */
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include "Kernels.h"
+
+namespace kernels {
+
+// Pack the first 8 bytes of a string into an integer
+uint64_t
+StrChunk::packPrefix(const std::string& str) {
+    uint64_t prefix = 0;
+    std::memcpy(&prefix, str.data(), std::min<size_t>(str.size(), 8));
+    return prefix;
+}
+
+// Set a given bit in a mask if value is true. The mask must be cleared
+// first, as the bit is never cleared.
+static inline void setBit(Mask mask, const int bit, const bool value) {
+    mask[bit / 64] |= uint64_t(value) << (bit % 64);
+}
+
+// Copy the bits in a small mask to a given position in a mask. The
+// position must be a multiple of the number of bits in the small mask.
+static inline void setBits(Mask mask, const int pos, const uint64_t bits) {
+    mask[pos / 64] |= bits << (pos % 64);
+}
+
+// ---------------------------[ Scalar ]------------------------------
+
+static void eqMaskScalar(const StrChunk& chunk, const uint64_t len,
+        const uint64_t prefix, Mask mask) {
+    for (int i = 0; i < chunk.count; i++) {
+        setBit(mask, i, chunk.len[i] == len && chunk.prefix[i] == prefix);
+    }
+}
+
+static bool cmpScalar(const double val, const Cmp cmp, const double value) {
+    switch (cmp) {
+    case Cmp::EQ: return val == value;
+    case Cmp::NE: return !(val == value);
+    case Cmp::LT: return val <  value;
+    case Cmp::LE: return val <= value;
+    case Cmp::GT: return val >  value;
+    case Cmp::GE: return val >= value;
+    }
+    return false;
+}
+
+static bool substrScalar(const std::string& needle, const char* hay,
+        const size_t len) {
+    return std::string_view(hay, len).find(needle) != std::string_view::npos;
+}
+
+static void cmpMaskScalar(const double* vals, const int start,
+        const int count, const Cmp cmp, const double value, Mask mask) {
+    for (int i = start; i < count; i++) {
+        setBit(mask, i, cmpScalar(vals[i], cmp, value));
+    }
+}
+
+// ----------------------------[ AVX2 ]-------------------------------
+
+__attribute__((target("avx2")))
+static void eqMaskAVX2(const StrChunk& chunk, const uint64_t len,
+        const uint64_t prefix, Mask mask) {
+    const __m256i vLen    = _mm256_set1_epi64x(len);
+    const __m256i vPrefix = _mm256_set1_epi64x(prefix);
+    int i = 0;
+    for (; i + 4 <= chunk.count; i += 4) {
+        const __m256i l = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(chunk.len + i));
+        const __m256i p = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(chunk.prefix + i));
+        const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi64(l, vLen),
+            _mm256_cmpeq_epi64(p, vPrefix));
+        setBits(mask, i, _mm256_movemask_pd(_mm256_castsi256_pd(eq)));
+    }
+    for (; i < chunk.count; i++) {
+        setBit(mask, i, chunk.len[i] == len && chunk.prefix[i] == prefix);
+    }
+}
+
+template<int Pred>
+__attribute__((target("avx2")))
+static void cmpMaskAVX2(const double* vals, const int count, const Cmp cmp,
+        const double value, Mask mask) {
+    const __m256d vValue = _mm256_set1_pd(value);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d v = _mm256_loadu_pd(vals + i);
+        setBits(mask, i, _mm256_movemask_pd(_mm256_cmp_pd(v, vValue, Pred)));
+    }
+    cmpMaskScalar(vals, i, count, cmp, value, mask);
+}
+
+__attribute__((target("avx2")))
+static bool substrAVX2(const std::string& needle, const char* hay,
+        const size_t len) {
+    const size_t k = needle.size();
+    if (k == 0 || len < k) {
+        return k == 0;
+    }
+    const __m256i first = _mm256_set1_epi8(needle.front());
+    const __m256i last  = _mm256_set1_epi8(needle.back());
+    size_t i = 0;
+    // Check 32 starting positions at a time, as long as the block of last
+    // characters is within the string.
+    for (; i + k - 1 + 32 <= len; i += 32) {
+        const __m256i blockFirst = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(hay + i));
+        const __m256i blockLast  = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(hay + i + k - 1));
+        uint32_t cand = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(blockFirst, first),
+            _mm256_cmpeq_epi8(blockLast, last)));
+        // Verify the characters between first & last at each candidate
+        for (; cand != 0; cand &= cand - 1) {
+            const int pos = __builtin_ctz(cand);
+            if (k <= 2 || std::memcmp(hay + i + pos + 1, needle.data() + 1,
+                    k - 2) == 0) {
+                return true;
+            }
+        }
+    }
+    // Check the few remaining starting positions using a regular search
+    return std::string_view(hay + i, len - i).find(needle) !=
+        std::string_view::npos;
+}
+
+// ---------------------------[ AVX-512 ]-----------------------------
+
+__attribute__((target("avx512f")))
+static void eqMaskAVX512(const StrChunk& chunk, const uint64_t len,
+        const uint64_t prefix, Mask mask) {
+    const __m512i vLen    = _mm512_set1_epi64(len);
+    const __m512i vPrefix = _mm512_set1_epi64(prefix);
+    int i = 0;
+    for (; i + 8 <= chunk.count; i += 8) {
+        const __m512i l = _mm512_loadu_si512(chunk.len + i);
+        const __m512i p = _mm512_loadu_si512(chunk.prefix + i);
+        const __mmask8 eq = _mm512_cmpeq_epi64_mask(l, vLen) &
+            _mm512_cmpeq_epi64_mask(p, vPrefix);
+        setBits(mask, i, eq);
+    }
+    for (; i < chunk.count; i++) {
+        setBit(mask, i, chunk.len[i] == len && chunk.prefix[i] == prefix);
+    }
+}
+
+template<int Pred>
+__attribute__((target("avx512f")))
+static void cmpMaskAVX512(const double* vals, const int count,
+        const Cmp cmp, const double value, Mask mask) {
+    const __m512d vValue = _mm512_set1_pd(value);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m512d v = _mm512_loadu_pd(vals + i);
+        setBits(mask, i, _mm512_cmp_pd_mask(v, vValue, Pred));
+    }
+    cmpMaskScalar(vals, i, count, cmp, value, mask);
+}
+
+// ---------------------------[ Dispatch ]----------------------------
+
+/** The instruction sets for which kernels are implemented */
+enum class ISA { SCALAR, AVX2, AVX512 };
+
+// Determine the best instruction set supported by this CPU just once
+static ISA getISA() {
+    static const ISA isa = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return ISA::AVX512;
+        if (__builtin_cpu_supports("avx2"))    return ISA::AVX2;
+        return ISA::SCALAR;
+    }();
+    return isa;
+}
+
+const char* isa() {
+    switch (getISA()) {
+    case ISA::AVX512: return "avx512";
+    case ISA::AVX2:   return "avx2";
+    default:          return "scalar";
+    }
+}
+
+SubstrMatcher::SubstrMatcher(const std::string& needle) : needle(needle) {
+    // There is no separate AVX-512 version as the AVX2 version is already
+    // limited by the verification of candidates rather than the filtering.
+    impl = (getISA() == ISA::SCALAR ? substrScalar : substrAVX2);
+}
+
+bool eqMask(const StrChunk& chunk, const std::vector<std::string>& values,
+        Mask mask) {
+    std::fill_n(mask, MaskWords, 0);
+    bool exact = true;
+    const ISA isa = getISA();
+    // An IN-list is handled as a union of the masks for each value
+    for (const auto& value : values) {
+        const uint64_t prefix = StrChunk::packPrefix(value);
+        switch (isa) {
+        case ISA::AVX512: eqMaskAVX512(chunk, value.size(), prefix, mask);
+            break;
+        case ISA::AVX2:   eqMaskAVX2(chunk, value.size(), prefix, mask);
+            break;
+        default:          eqMaskScalar(chunk, value.size(), prefix, mask);
+        }
+        exact = exact && (value.size() <= 8);
+    }
+    return exact;
+}
+
+void cmpMask(const NumChunk& chunk, const Cmp cmp, const double value,
+        Mask mask) {
+    std::fill_n(mask, MaskWords, 0);
+    const double* vals = chunk.vals;
+    const int count    = chunk.count;
+    // The comparison predicate must be a compile-time constant for the
+    // SIMD compare instructions. Hence the templated versions.
+    switch (getISA()) {
+    case ISA::AVX512:
+        switch (cmp) {
+        case Cmp::EQ: return cmpMaskAVX512<_CMP_EQ_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::NE: return cmpMaskAVX512<_CMP_NEQ_UQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::LT: return cmpMaskAVX512<_CMP_LT_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::LE: return cmpMaskAVX512<_CMP_LE_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::GT: return cmpMaskAVX512<_CMP_GT_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::GE: return cmpMaskAVX512<_CMP_GE_OQ>(vals, count, cmp,
+                value, mask);
+        }
+        break;
+    case ISA::AVX2:
+        switch (cmp) {
+        case Cmp::EQ: return cmpMaskAVX2<_CMP_EQ_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::NE: return cmpMaskAVX2<_CMP_NEQ_UQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::LT: return cmpMaskAVX2<_CMP_LT_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::LE: return cmpMaskAVX2<_CMP_LE_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::GT: return cmpMaskAVX2<_CMP_GT_OQ>(vals, count, cmp,
+                value, mask);
+        case Cmp::GE: return cmpMaskAVX2<_CMP_GE_OQ>(vals, count, cmp,
+                value, mask);
+        }
+        break;
+    default:
+        break;
+    }
+    cmpMaskScalar(vals, 0, count, cmp, value, mask);
+}
+
+}  // namespace kernels
@@ -0,0 +1,178 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/*
+ * A set of SIMD kernels used to evaluate where clause conditions on a
+ * batch of rows. Each kernel compares a chunk of column values against a
+ * value and emits a bitmask, with one bit per row in the chunk. Kernels
+ * are implemented for AVX-512 and AVX2 along with a scalar fallback. The
+ * implementation to be used is chosen at runtime based on the CPU.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kernels {
+    /**
+     * The maximum number of values in a chunk processed by a kernel. It
+     * covers a batch of rows (see QueryPlan::BatchSize) and is kept small
+     * as filtering a where clause puts a few arrays of this size on the
+     * stack for each level of nesting.
+     */
+    constexpr int ChunkSize = 64;
+
+    /** The number of 64-bit words in a bitmask for a chunk */
+    constexpr int MaskWords = ChunkSize / 64;
+
+    /** A bitmask with one bit for each value in a chunk */
+    using Mask = uint64_t[MaskWords];
+
+    /**
+     * The comparisons supported by the numeric kernel.
+     */
+    enum class Cmp { EQ, NE, LT, LE, GT, GE };
+
+    /**
+     * A chunk of values from a string column laid out so that the SIMD
+     * kernels can compare them. Each string is represented by its length
+     * and its first 8 bytes (zero padded). Two strings of at most 8 bytes
+     * are equal if and only if both their lengths and prefixes are equal.
+     * Longer strings with equal keys have to be verified by the caller.
+     */
+    struct StrChunk {
+        /** The length of each string in the chunk */
+        uint64_t len[ChunkSize];
+        /** The first 8 bytes of each string in the chunk, zero padded */
+        uint64_t prefix[ChunkSize];
+        /** The number of valid entries in the chunk */
+        int count = 0;
+
+        /**
+         * Convenience method to add a string to this chunk.
+         *
+         * @param str The string to be added. Only its length and prefix
+         * are stored.
+         */
+        void add(const std::string& str) {
+            len[count]    = str.size();
+            prefix[count] = packPrefix(str);
+            count++;
+        }
+
+        /**
+         * Pack the first 8 bytes of a string into an integer. Strings
+         * shorter than 8 bytes are padded with zeros.
+         *
+         * @param str The string whose prefix is to be returned.
+         *
+         * @return The first 8 bytes of str as an integer.
+         */
+        static uint64_t packPrefix(const std::string& str);
+    };
+
+    /**
+     * A chunk of values from a column, parsed as numbers, for use by the
+     * numeric SIMD kernel.
+     */
+    struct NumChunk {
+        /** The numbers in the chunk. Values that are not numbers are NaN */
+        double vals[ChunkSize];
+        /** The number of valid entries in the chunk */
+        int count = 0;
+
+        /**
+         * Convenience method to add a number to this chunk.
+         *
+         * @param val The number to be added.
+         */
+        void add(const double val) { vals[count++] = val; }
+    };
+
+    /**
+     * Set the bits in a mask for strings in a chunk whose length and
+     * prefix match that of any one of the given values. With one value
+     * this is the candidate set for "=" while with multiple values it is
+     * the candidate set for an IN-list.
+     *
+     * @param chunk The chunk of strings to be checked.
+     *
+     * @param values The values to compare against.
+     *
+     * @param mask The mask into which the results are written. Bits for
+     * entries beyond chunk.count are cleared.
+     *
+     * @return This method returns true if the mask is exact, i.e., none of
+     * the values is longer than 8 bytes. Otherwise, the caller must verify
+     * each set bit by comparing the full strings.
+     */
+    bool eqMask(const StrChunk& chunk, const std::vector<std::string>& values,
+        Mask mask);
+
+    /**
+     * Set the bits in a mask for numbers in a chunk that satisfy a given
+     * comparison against a value.
+     *
+     * @param chunk The numbers to be checked. Values that could not be
+     * parsed as numbers are expected to be NaN, which never satisfies a
+     * comparison other than NE.
+     *
+     * @param cmp The comparison to be performed.
+     *
+     * @param value The number to compare against.
+     *
+     * @param mask The mask into which the results are written.
+     */
+    void cmpMask(const NumChunk& chunk, const Cmp cmp, const double value,
+        Mask mask);
+
+    /**
+     * A substring search kernel for the "like" condition. The value to
+     * search for is prepared once (typically when a query plan is built)
+     * and the matcher is then reused for every row. The SIMD version
+     * compares 32 positions at a time against the first and the last
+     * character of the value, and only compares the full value at
+     * positions where both characters match.
+     */
+    class SubstrMatcher {
+    public:
+        /**
+         * Prepare a matcher to search for a given value.
+         *
+         * @param needle The value to search for in each string.
+         */
+        explicit SubstrMatcher(const std::string& needle = "");
+
+        /**
+         * Check if the value for this matcher occurs in a given string.
+         *
+         * @param hay The string to be searched.
+         *
+         * @return This method returns true if the value occurs anywhere in
+         * hay, just like hay.find(value) != std::string::npos.
+         */
+        bool matches(const std::string& hay) const {
+            return impl(needle, hay.data(), hay.size());
+        }
+
+    private:
+        /** The value to be searched for */
+        std::string needle;
+
+        /** The implementation chosen for this CPU when constructed */
+        bool (*impl)(const std::string& needle, const char* hay,
+            const size_t len);
+    };
+
+    /**
+     * Obtain the name of the instruction set used by the kernels on this
+     * CPU. This is mainly for logging and troubleshooting.
+     *
+     * @return One of "avx512", "avx2", or "scalar".
+     */
+    const char* isa();
+}  // namespace kernels
+
+#endif /* KERNELS_H */
@@ -0,0 +1,163 @@
+/* copyright caohd 2023
+ * Implementation of materialized views that are maintained incrementally
+ * as the rows of the underlying CSV change.
+ */
+
+#include "MaterializedView.h"
+#include "ResultWriter.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+bool
+MaterializedView::ValueLess::operator()(
+        const std::pair<double, std::string>& val1,
+        const std::pair<double, std::string>& val2) const {
+    return RowOrder::compare(val1.second, val1.first, val2.second,
+        val2.first) < 0;
+}
+
+void
+MaterializedView::build(CSV& csv) {
+    // Rows are added one at a time so that changes to rows which have
+    // already been added are applied to the view (see rowChanged).
+    const int numRows = csv.size();
+    for (int r = 0; r < numRows; r++) {
+        Guard rowGuard(csv[r].rowMutex);
+        Guard viewGuard(viewMutex);
+        if (plan.matches(csv[r])) {
+            apply(r, csv[r], true);
+        }
+        builtRows = r + 1;
+    }
+}
+
+void
+MaterializedView::rowChanged(const int rowIdx, const CSVRow& oldRow,
+        const CSVRow& newRow) {
+    Guard g(viewMutex);
+    if (rowIdx >= builtRows) {
+        return;  // The new row will be added by build()
+    }
+    if (plan.matches(oldRow)) {
+        apply(rowIdx, oldRow, false);
+    }
+    if (plan.matches(newRow)) {
+        apply(rowIdx, newRow, true);
+    }
+}
+
+void
+MaterializedView::apply(const int rowIdx, const CSVRow& row,
+        const bool add) {
+    if (plan.aggs.empty()) {
+        // A projection view just has the selected values of each row. They
+        // are formatted when printed, as the format depends on the client.
+        if (add) {
+            StrVec& values = rows[rowIdx];
+            values.clear();
+            for (const int col : plan.colIdx) {
+                values.push_back(row[col]);
+            }
+        } else {
+            rows.erase(rowIdx);
+        }
+        return;
+    }
+    std::string key;
+    for (const int col : plan.groupCols) {
+        key += row[col];
+        key += '\0';
+    }
+    auto entry = groups.find(key);
+    if (entry == groups.end()) {
+        Group group;
+        for (const int col : plan.groupCols) {
+            group.keys.push_back(row[col]);
+        }
+        group.states.resize(plan.aggs.size());
+        group.values.resize(plan.aggs.size());
+        entry = groups.emplace(key, std::move(group)).first;
+    }
+    Group& group = entry->second;
+    group.rows += (add ? 1 : -1);
+    for (size_t i = 0; i < plan.aggs.size(); i++) {
+        const AggSpec& spec = plan.aggs[i];
+        if (spec.func == AggSpec::Func::MIN ||
+            spec.func == AggSpec::Func::MAX) {
+            const std::string& value = row[spec.colIdx];
+            if (value.empty()) {
+                continue;
+            }
+            ValueCounts& counts = group.values[i];
+            const auto val = std::make_pair(WhereExpr::toNumber(value), value);
+            if (add) {
+                counts[val]++;
+            } else if (--counts[val] == 0) {
+                counts.erase(val);
+            }
+        } else if (spec.func != AggSpec::Func::VALUE) {
+            if (add) {
+                group.states[i].add(spec, row);
+            } else {
+                group.states[i].remove(spec, row);
+            }
+        }
+    }
+    if (group.rows == 0) {
+        groups.erase(entry);
+    }
+}
+
+void
+MaterializedView::print(std::ostream& os) {
+    ResultWriter out(os, plan.colNames);
+    const auto enc = out.getEncoding();
+    std::string rowText;
+    int rowCount = 0;
+    Guard g(viewMutex);
+    if (plan.aggs.empty()) {
+        for (const auto& row : rows) {
+            for (size_t i = 0; i < row.second.size(); i++) {
+                ResultWriter::appendValue(rowText, row.second[i], i == 0, enc);
+            }
+            ResultWriter::endRow(rowText, enc);
+        }
+        rowCount = rows.size();
+    } else {
+        // Without a group by, there is always one row (with a count of
+        // zero if no rows match)
+        const Group empty{{}, 0, std::vector<AggState>(plan.aggs.size()),
+            std::vector<ValueCounts>(plan.aggs.size())};
+        std::vector<const Group*> toPrint;
+        for (const auto& entry : groups) {
+            toPrint.push_back(&entry.second);
+        }
+        if (plan.groupCols.empty() && toPrint.empty()) {
+            toPrint.push_back(&empty);
+        }
+        for (const Group* group : toPrint) {
+            for (size_t i = 0; i < plan.aggs.size(); i++) {
+                const AggSpec& spec = plan.aggs[i];
+                const ValueCounts& counts = group->values[i];
+                std::string value;
+                if (spec.func == AggSpec::Func::VALUE) {
+                    value = group->keys[spec.colIdx];
+                } else if (spec.func == AggSpec::Func::MIN) {
+                    value = (counts.empty() ? "" :
+                        counts.begin()->first.second);
+                } else if (spec.func == AggSpec::Func::MAX) {
+                    value = (counts.empty() ? "" :
+                        counts.rbegin()->first.second);
+                } else {
+                    value = group->states[i].result(spec);
+                }
+                ResultWriter::appendValue(rowText, value, i == 0, enc);
+            }
+            ResultWriter::endRow(rowText, enc);
+        }
+        rowCount = toPrint.size();
+    }
+    out.write(rowText, rowCount);
+    out.finish();
+}
@@ -0,0 +1,146 @@
+#ifndef MATERIALIZED_VIEW_H
+#define MATERIALIZED_VIEW_H
+
+/*
+ * Materialized views whose contents are maintained incrementally as the
+ * rows of the underlying CSV change. Views are created via queries such
+ * as:
+ *
+ *     create materialized view v1 as select title from test.csv
+ *         where year = 2006;
+ *     create materialized view v2 as select year, count(*), avg(rating)
+ *         from test.csv group by year;
+ *
+ * and their contents are read via "select * from v1". Each change to a
+ * row is applied to the views of its CSV as the removal of the old row
+ * and the addition of the new row, so views are never recomputed.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "QueryPlan.h"
+
+/**
+ * A materialized view defined by a select query on a single CSV. The
+ * query can either select columns (a projection view) or have aggregates,
+ * optionally with a group by clause (an aggregate view). Order by and
+ * limit clauses are not supported in views.
+ */
+class MaterializedView {
+public:
+    /**
+     * Create an empty view. The build() method must be called to add
+     * the existing rows in the CSV to the view.
+     *
+     * @param plan The compiled select query that defines the view.
+     */
+    explicit MaterializedView(QueryPlan plan) : plan(std::move(plan)) {}
+
+    /**
+     * Add the existing rows in a CSV to this view. Changes made to rows
+     * (via rowChanged()) while the view is being built are handled
+     * correctly, as long as the view is registered to receive changes
+     * before this method is called, and updates that started before the
+     * view was registered have finished.
+     *
+     * @param csv The CSV on which this view is defined.
+     */
+    void build(CSV& csv);
+
+    /**
+     * Apply a change to a row of the CSV to this view.
+     *
+     * @note The caller must hold the mutex of the row.
+     *
+     * @param rowIdx The index of the row in the CSV.
+     *
+     * @param oldRow The values in the row before the change.
+     *
+     * @param newRow The values in the row after the change.
+     */
+    void rowChanged(const int rowIdx, const CSVRow& oldRow,
+        const CSVRow& newRow);
+
+    /**
+     * Print the contents of this view in the same format as the results
+     * of a select query. Groups in an aggregate view are printed in
+     * ascending order of their group by values.
+     *
+     * @param os The output stream to where the contents are written.
+     */
+    void print(std::ostream& os);
+
+private:
+    /**
+     * The values of a min or max aggregate in a group, along with the
+     * number of times each value occurs. They are ordered in the same
+     * type-aware manner as order by, so that the minimum and maximum
+     * can be maintained when values are removed.
+     */
+    struct ValueLess {
+        bool operator()(const std::pair<double, std::string>& val1,
+            const std::pair<double, std::string>& val2) const;
+    };
+    using ValueCounts = std::map<std::pair<double, std::string>, int,
+        ValueLess>;
+
+    /** A group in an aggregate view */
+    struct Group {
+        /** The values of the group by columns for this group */
+        StrVec keys;
+
+        /** The number of rows in this group */
+        int rows = 0;
+
+        /** The state of each count, sum, or avg aggregate */
+        std::vector<AggState> states;
+
+        /** The values of each min or max aggregate */
+        std::vector<ValueCounts> values;
+    };
+
+    /**
+     * Add a row to (or remove a row from) this view. The caller must
+     * hold viewMutex.
+     *
+     * @param rowIdx The index of the row in the CSV.
+     *
+     * @param row The values in the row.
+     *
+     * @param add If true the row is added. Otherwise it is removed.
+     */
+    void apply(const int rowIdx, const CSVRow& row, const bool add);
+
+    /** The compiled select query that defines this view */
+    const QueryPlan plan;
+
+    /** The mutex to protect the contents of this view */
+    std::mutex viewMutex;
+
+    /** The number of rows in the CSV that have been added to this view by
+     * build(). Changes to the rest of the rows are ignored as those rows
+     * are added later by build().
+     */
+    int builtRows = 0;
+
+    /** The selected values of the rows in a projection view, keyed by
+     * row index.
+     */
+    std::map<int, StrVec> rows;
+
+    /** The groups in an aggregate view, keyed by the group by values
+     * separated by a '\0' character.
+     */
+    std::map<std::string, Group> groups;
+};
+
+/** The materialized views defined on a CSV */
+using MaterializedViews = std::vector<std::shared_ptr<MaterializedView>>;
+
+#endif /* MATERIALIZED_VIEW_H */
@@ -0,0 +1,73 @@
+/* copyright caohd 2023
+ * Implementation of the classes used to sort the rows selected by a query
+ * with an order by clause.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "OrderBy.h"
+
+int
+RowOrder::compare(const std::string& val1, const double num1,
+        const std::string& val2, const double num2) {
+    const bool isNum1 = !std::isnan(num1), isNum2 = !std::isnan(num2);
+    if (isNum1 && isNum2) {
+        return (num1 < num2 ? -1 : (num1 > num2 ? 1 : 0));
+    }
+    if (isNum1 != isNum2) {
+        return (isNum1 ? -1 : 1);  // Numbers come before other strings
+    }
+    return val1.compare(val2);
+}
+
+bool
+RowOrder::operator()(const OrderedRow& row1, const OrderedRow& row2) const {
+    const int cmp = compare(row1.key, row1.number, row2.key, row2.number);
+    if (cmp == 0) {
+        return row1.rowIdx < row2.rowIdx;
+    }
+    return (desc ? cmp > 0 : cmp < 0);
+}
+
+bool
+OrderedRows::accepts(const OrderedRow& row) const {
+    return maxRows > 0 && (static_cast<int>(rows.size()) < maxRows ||
+        order(row, rows.front()));
+}
+
+void
+OrderedRows::add(OrderedRow&& row) {
+    if (maxRows == INT_MAX) {
+        // Not bounded. So there is no need to maintain a heap.
+        rows.push_back(std::move(row));
+        return;
+    }
+    if (static_cast<int>(rows.size()) == maxRows) {
+        // Drop the last row in order which is at the top of the heap
+        std::pop_heap(rows.begin(), rows.end(), order);
+        rows.pop_back();
+    }
+    rows.push_back(std::move(row));
+    std::push_heap(rows.begin(), rows.end(), order);
+}
+
+void
+OrderedRows::sort() {
+    std::sort(rows.begin(), rows.end(), order);
+}
+
+void
+OrderedRows::merge(OrderedRows& other) {
+    std::vector<OrderedRow> merged;
+    merged.reserve(std::min<size_t>(rows.size() + other.rows.size(),
+        maxRows));
+    auto it1 = rows.begin(), it2 = other.rows.begin();
+    while (static_cast<int>(merged.size()) < maxRows &&
+           (it1 != rows.end() || it2 != other.rows.end())) {
+        const bool takeOther = (it1 == rows.end() ||
+            (it2 != other.rows.end() && order(*it2, *it1)));
+        merged.push_back(std::move(takeOther ? *it2++ : *it1++));
+    }
+    rows.swap(merged);
+    other.rows.clear();
+}
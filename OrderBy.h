@@ -0,0 +1,166 @@
+#ifndef ORDER_BY_H
+#define ORDER_BY_H
+
+/*
+ * Classes to sort the rows selected by a query with an order by clause,
+ * for example:
+ *
+ *     select name, alt from airports.csv order by alt desc limit 20;
+ *
+ * When a query also has a limit, only the best (offset + limit) rows are
+ * kept in a bounded heap while scanning. Otherwise, the rows found by
+ * each thread are sorted separately and the sorted runs are then merged.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <climits>
+#include <string>
+#include <vector>
+
+/**
+ * A row selected by a query with an order by clause. The row is formatted
+ * when it is selected (while its mutex is held), so that it can be printed
+ * later without accessing the CSV again.
+ */
+struct OrderedRow {
+    /** The value of the order by column in the row */
+    std::string key;
+
+    /** The key as a number. It is NaN if the key is not a number */
+    double number;
+
+    /** The index of the row in the CSV. It is used to break ties */
+    int rowIdx;
+
+    /** The formatted output line for the row, including the newline */
+    std::string text;
+};
+
+/**
+ * The order by clause of a query. Keys are compared in a type-aware
+ * manner: two numbers are compared numerically, numbers come before other
+ * strings, and other strings are compared lexicographically. Rows with
+ * equal keys stay in the order in which they appear in the CSV.
+ */
+class RowOrder {
+public:
+    /**
+     * Create an order by clause.
+     *
+     * @param colIdx The index of the column to order by. If this value is
+     * -1, then the query does not have an order by clause.
+     *
+     * @param desc If this flag is true the rows are in descending order.
+     */
+    explicit RowOrder(const int colIdx = -1, const bool desc = false) :
+        colIdx(colIdx), desc(desc) {}
+
+    /**
+     * Determine if a row must be printed before another row.
+     *
+     * @param row1 The first row to be compared.
+     *
+     * @param row2 The second row to be compared.
+     *
+     * @return This method returns true if row1 comes before row2.
+     */
+    bool operator()(const OrderedRow& row1, const OrderedRow& row2) const;
+
+    /**
+     * Compare two values from a CSV in a type-aware manner, as described
+     * in the documentation for this class.
+     *
+     * @param val1 The first value to be compared.
+     *
+     * @param num1 The first value as a number, or NaN if it is not one.
+     *
+     * @param val2 The second value to be compared.
+     *
+     * @param num2 The second value as a number, or NaN if it is not one.
+     *
+     * @return A negative value if val1 comes before val2, zero if they
+     * are equal, and a positive value otherwise.
+     */
+    static int compare(const std::string& val1, const double num1,
+        const std::string& val2, const double num2);
+
+    /**
+     * Determine if the query does not have an order by clause.
+     *
+     * @return This method returns true if there is no order by clause.
+     */
+    bool empty() const { return colIdx == -1; }
+
+    /** The index of the column to order by, or -1 if there is none */
+    int colIdx;
+
+    /** Flag to indicate if the rows are to be in descending order */
+    bool desc;
+};
+
+/**
+ * A sorted list of rows with an optional bound on the number of rows.
+ * While rows are being added, a bounded list is kept as a heap whose top
+ * is the last row in order, so that rows which cannot make the cut are
+ * rejected via a single comparison. The sort() method must be called
+ * after all the rows have been added.
+ */
+class OrderedRows {
+public:
+    /**
+     * Create an empty list of rows.
+     *
+     * @param order The order by clause used to compare rows.
+     *
+     * @param maxRows The maximum number of rows to be kept. Only the
+     * rows that come first in order are kept.
+     */
+    explicit OrderedRows(const RowOrder& order, const int maxRows = INT_MAX) :
+        order(order), maxRows(maxRows) {}
+
+    /**
+     * Determine if a row would be kept if it were added. This method is
+     * used to avoid formatting rows that would be rejected anyway.
+     *
+     * @param row The row to be checked. Only its key, number, and rowIdx
+     * are used.
+     *
+     * @return This method returns true if the row would be kept.
+     */
+    bool accepts(const OrderedRow& row) const;
+
+    /**
+     * Add a row to this list. If the list already has maxRows rows, then
+     * the last row in order is dropped.
+     *
+     * @param row The row to be added. It should be accepted by this list.
+     */
+    void add(OrderedRow&& row);
+
+    /**
+     * Sort the rows in this list. Rows must not be added afterwards.
+     */
+    void sort();
+
+    /**
+     * Merge the rows in another sorted list into this sorted list. Only
+     * the first maxRows rows are kept.
+     *
+     * @param other The sorted list of rows to be merged. Its rows are
+     * moved into this list.
+     */
+    void merge(OrderedRows& other);
+
+    /** The rows in this list. They are in order only after sort() */
+    std::vector<OrderedRow> rows;
+
+private:
+    /** The order by clause used to compare rows */
+    RowOrder order;
+
+    /** The maximum number of rows to be kept in this list */
+    int maxRows;
+};
+
+#endif /* ORDER_BY_H */
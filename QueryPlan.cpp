@@ -0,0 +1,55 @@
+/* copyright caohd 2023
+ * Implementation of the QueryPlan class that compiles a validated query
+ * into pre-resolved column indices and a where clause.
+ */
+
+#include <string>
+#include "QueryPlan.h"
+
+// A batch of rows must fit in a chunk processed by the SIMD kernels
+static_assert(QueryPlan::BatchSize <= kernels::ChunkSize);
+
+QueryPlan::QueryPlan(const CSV& csv, StrVec colNames, const int whereColIdx,
+        const std::string& cond, const std::string& value, StrVec values) :
+        QueryPlan(csv, std::move(colNames), WhereExpr(whereColIdx, cond, value),
+            std::move(values)) {
+}
+
+QueryPlan::QueryPlan(const CSV& csv, StrVec colNames, WhereExpr where,
+        StrVec values) : colNames(std::move(colNames)),
+        values(std::move(values)), where(std::move(where)) {
+    // Convert any "*" to suitable column names. See CSV::getColumnNames()
+    if (!this->colNames.empty() && this->colNames[0] == "*") {
+        this->colNames = csv.getColumnNames();
+    }
+    // Resolve each column name to its index position just once
+    for (const auto& colName : this->colNames) {
+        colIdx.push_back(csv.getColumnIndex(colName));
+    }
+}
+
+// Evaluate the where clause on a batch of rows into a selection vector
+int QueryPlan::filter(const CSV& csv, const int start, const int end,
+        int* sel) const {
+    for (int i = start; i < end; i++) {
+        sel[i - start] = i;
+    }
+    return (where.empty() ? end - start :
+        where.filter(csv, sel, end - start, sel));
+}
+
+// Append the selected columns of a row to a string. The column indices
+// were resolved once when compiling the plan
+void QueryPlan::appendRow(const CSVRow& row, std::string& rowText) const {
+    if (encoding == ResultWriter::Encoding::TSV) {
+        for (size_t i = 0; i < colIdx.size(); i++) {
+            if (i > 0) rowText += '\t';
+            rowText += row[colIdx[i]];
+        }
+        rowText += '\n';
+        return;
+    }
+    for (size_t i = 0; i < colIdx.size(); i++) {
+        ResultWriter::appendValue(rowText, row[colIdx[i]], i == 0, encoding);
+    }
+}
@@ -0,0 +1,168 @@
+#ifndef QUERY_PLAN_H
+#define QUERY_PLAN_H
+
+/*
+ * A compiled form of a validated select or update query. The column names,
+ * where clause, and values in a query are resolved against a CSV once, so
+ * that the per-row processing in SQLAir only performs indexed accesses.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <string>
+#include <vector>
+#include "CSV.h"
+#include "WhereExpr.h"
+#include "OrderBy.h"
+#include "Aggregate.h"
+#include "ResultWriter.h"
+
+/**
+ * A query plan holds the information needed to process each row of a CSV
+ * for a select or an update query. Plans are built once per query (after
+ * the query has been validated) and are then only read. Hence, a plan can
+ * be safely shared by multiple threads.
+ */
+class QueryPlan {
+public:
+    /**
+     * The number of rows processed as one batch by the filter() method.
+     * The mutexes of all the rows in a batch are held while the batch is
+     * filtered and its selected rows are copied. So the batch is kept
+     * small: an update waits for at most one batch, and a thread holds
+     * well under the 64 mutexes that ThreadSanitizer can track at once.
+     */
+    static constexpr int BatchSize = 32;
+
+    /**
+     * Compile a query into a plan for a given CSV.
+     *
+     * @param csv The CSV against which the column names are to be resolved.
+     *
+     * @param colNames The column names to be printed (select) or set
+     * (update). For select queries the list can be just {"*"}, which is
+     * expanded to all the columns in the CSV.
+     *
+     * @param whereColIdx The index of the column in the where clause. It
+     * is -1 if the query does not have a where clause.
+     *
+     * @param cond The condition in the where clause, i.e., "=", "<>", or
+     * "like". It is an empty string if there is no where clause.
+     *
+     * @param value The value in the where clause to compare against.
+     *
+     * @param values The values to be set by an update query. This list
+     * is empty for select queries.
+     */
+    QueryPlan(const CSV& csv, StrVec colNames, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        StrVec values = {});
+
+    /**
+     * Compile a query with a general where clause into a plan.
+     *
+     * @param csv The CSV against which the column names are to be resolved.
+     *
+     * @param colNames The column names to be printed (select) or set
+     * (update). For select queries the list can be just {"*"}, which is
+     * expanded to all the columns in the CSV.
+     *
+     * @param where The parsed where clause. It may be empty.
+     *
+     * @param values The values to be set by an update query. This list
+     * is empty for select queries.
+     */
+    QueryPlan(const CSV& csv, StrVec colNames, WhereExpr where,
+        StrVec values = {});
+
+    /**
+     * Check if a given row satisfies the where clause in this plan.
+     *
+     * @note The caller must hold the row's mutex.
+     *
+     * @param row The row to be checked.
+     *
+     * @return This method returns true if the row satisfies the where
+     * clause or if the query does not have a where clause.
+     */
+    bool matches(const CSVRow& row) const {
+        return where.matches(row);
+    }
+
+    /**
+     * Evaluate the where clause on a batch of consecutive rows and record
+     * the index of each matching row in a selection vector. See
+     * WhereExpr::filter() for details.
+     *
+     * @note The caller must hold the mutexes of all the rows in the batch.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param start The index of the first row in the batch.
+     *
+     * @param end The index one past the last row in the batch. The batch
+     * must not have more than BatchSize rows.
+     *
+     * @param sel The selection vector into which the indices of the
+     * matching rows are written. It must have space for end - start
+     * entries.
+     *
+     * @return The number of matching rows written to sel.
+     */
+    int filter(const CSV& csv, const int start, const int end,
+        int* sel) const;
+
+    /**
+     * Append the values of the selected columns in a row to a given
+     * string, in the encoding of this plan.
+     *
+     * @note The caller must hold the row's mutex.
+     *
+     * @param row The row to be printed.
+     *
+     * @param rowText The string to which the values are appended.
+     */
+    void appendRow(const CSVRow& row, std::string& rowText) const;
+
+    /** The names of the columns (with any "*" expanded) in the query. */
+    StrVec colNames;
+
+    /** The index of each column in colNames in the CSV */
+    std::vector<int> colIdx;
+
+    /** The values to be set for each column (update queries only) */
+    StrVec values;
+
+    /** The where clause, with its conditions already reordered */
+    WhereExpr where;
+
+    /** The aggregates in the select list. If this list is not empty,
+     * then colNames has the name of each aggregate (e.g., "avg(rating)")
+     * and a single row with the value of each aggregate is printed.
+     */
+    std::vector<AggSpec> aggs;
+
+    /** The indices of the columns in the group by clause, if any */
+    std::vector<int> groupCols;
+
+    /** The order in which selected rows are to be printed, if any */
+    RowOrder order;
+
+    /** The maximum number of rows to be selected, or -1 for no limit */
+    int limit = -1;
+
+    /** The number of matching rows to be skipped before selecting rows */
+    int offset = 0;
+
+    /** The maximum number of milliseconds a wait query waits for rows to
+     * match, or -1 to use the default of the server.
+     */
+    int timeout = -1;
+
+    /** The encoding in which selected rows are formatted. It depends on
+     * the format in which the results are written (see ResultWriter).
+     */
+    ResultWriter::Encoding encoding = ResultWriter::Encoding::TSV;
+};
+
+#endif /* QUERY_PLAN_H */
@@ -0,0 +1,93 @@
+/* copyright caohd 2023
+ * Implementation of the bounded cache of the results of select queries.
+ */
+
+#include "ResultCache.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+void
+ResultCache::bump(const CSV& csv) {
+    Guard g(cacheMutex);
+    versions[&csv]++;
+}
+
+std::string
+ResultCache::makeKey(const StrVec& sql, const std::vector<CSV*>& csvs) {
+    std::string key;
+    for (const auto& tok : sql) {
+        key += tok;
+        key += '\0';
+    }
+    // CSVs are never removed from memory, so their addresses identify them
+    Guard g(cacheMutex);
+    for (const CSV* csv : csvs) {
+        const auto entry = versions.find(csv);
+        key += std::to_string(reinterpret_cast<uintptr_t>(csv)) + ':' +
+            std::to_string(entry == versions.end() ? 0 : entry->second) + ';';
+    }
+    return key;
+}
+
+ResultCache::Result
+ResultCache::lookup(const std::string& key) {
+    Guard g(cacheMutex);
+    const auto entry = entries.find(key);
+    if (entry == entries.end()) {
+        return nullptr;
+    }
+    // Move the entry to the front as it is the most recently used one
+    lru.splice(lru.begin(), lru, entry->second);
+    return entry->second->second;
+}
+
+void
+ResultCache::insert(const std::string& key, std::string result) {
+    if (result.size() > maxBytes / 8) {
+        return;  // Too big to be worth caching
+    }
+    Guard g(cacheMutex);
+    if (entries.find(key) != entries.end()) {
+        return;  // Another thread processed the same query concurrently
+    }
+    bytes += result.size();
+    lru.emplace_front(key, std::make_shared<const std::string>(
+        std::move(result)));
+    entries[key] = lru.begin();
+    // Evict the least recently used entries to stay within the limit
+    while (bytes > maxBytes) {
+        bytes -= lru.back().second->size();
+        entries.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+ResultRecorder::int_type
+ResultRecorder::overflow(int_type ch) {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    const char c = traits_type::to_char_type(ch);
+    return (xsputn(&c, 1) == 1 ? ch : traits_type::eof());
+}
+
+std::streamsize
+ResultRecorder::xsputn(const char* s, std::streamsize n) {
+    if (!tooBig) {
+        if (result.size() + n > maxSize) {
+            tooBig = true;
+            std::string().swap(result);  // Release the memory right away
+        } else {
+            result.append(s, n);
+        }
+    }
+    os.write(s, n);
+    return (os ? n : 0);
+}
+
+int
+ResultRecorder::sync() {
+    os.flush();
+    return (os ? 0 : -1);
+}
@@ -0,0 +1,171 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+/*
+ * A bounded cache of the results of select queries. Each CSV has a
+ * version number that is incremented whenever its rows are changed. The
+ * cached results are keyed on the query along with the versions of the
+ * CSVs used by the query, so that results for an older version of a CSV
+ * are never served (and are eventually evicted).
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+#include <unordered_map>
+#include "CSV.h"
+
+/**
+ * A thread-safe least-recently-used cache of query results bounded by the
+ * total size of the results.
+ */
+class ResultCache {
+public:
+    /** A cached result, which is shared with the threads serving it */
+    using Result = std::shared_ptr<const std::string>;
+
+    /**
+     * Create an empty cache.
+     *
+     * @param maxBytes The maximum total size of the cached results.
+     * Results larger than an eighth of this size are not cached.
+     */
+    explicit ResultCache(const size_t maxBytes = 64 * 1024 * 1024) :
+        maxBytes(maxBytes) {}
+
+    /**
+     * Increment the version of a CSV because its rows have changed. This
+     * method must be called after the rows have been changed.
+     *
+     * @param csv The CSV that was changed.
+     */
+    void bump(const CSV& csv);
+
+    /**
+     * Create the key for a query using the current versions of the CSVs
+     * used by the query. The key must be created before the query is
+     * processed.
+     *
+     * @param sql The tokens in the query. Since the tokens are already
+     * normalized (e.g., in lower case and without extra spaces), queries
+     * that differ only in such details have the same key.
+     *
+     * @param csvs The CSVs used by the query.
+     *
+     * @return The key for the query.
+     */
+    std::string makeKey(const StrVec& sql, const std::vector<CSV*>& csvs);
+
+    /**
+     * Find the cached result for a given key.
+     *
+     * @param key The key created via makeKey().
+     *
+     * @return The cached result, or nullptr if there is no cached result.
+     */
+    Result lookup(const std::string& key);
+
+    /**
+     * Add the result for a key to the cache, evicting the least recently
+     * used results as needed.
+     *
+     * @param key The key created via makeKey().
+     *
+     * @param result The result (as written to the client) for the key.
+     */
+    void insert(const std::string& key, std::string result);
+
+    /**
+     * Obtain the size of the largest result that is cached.
+     *
+     * @return The largest size of a result passed to insert() that is
+     * added to the cache.
+     */
+    size_t maxResultSize() const { return maxBytes / 8; }
+
+private:
+    /** An entry in the cache, i.e., the key and the result */
+    using Entry = std::pair<std::string, Result>;
+
+    /** The mutex to protect all the data in this cache */
+    std::mutex cacheMutex;
+
+    /** The version of each CSV that has been changed */
+    std::unordered_map<const CSV*, uint64_t> versions;
+
+    /** The cached entries, with the most recently used ones at the front */
+    std::list<Entry> lru;
+
+    /** The position of each cached entry in lru */
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+
+    /** The total size of the results currently in the cache */
+    size_t bytes = 0;
+
+    /** The maximum total size of the results in the cache */
+    const size_t maxBytes;
+};
+
+/**
+ * An output stream buffer that writes a result through to another stream
+ * as it is produced, while recording a copy of it to be cached. Recording
+ * stops (and the copy is discarded) once the result becomes too large to
+ * be cached, so that large results are streamed without being buffered.
+ */
+class ResultRecorder : public std::streambuf {
+public:
+    /**
+     * Create a recorder.
+     *
+     * @param os The stream to where the result is written.
+     *
+     * @param maxSize The size beyond which the result is not recorded.
+     */
+    ResultRecorder(std::ostream& os, const size_t maxSize) :
+        os(os), maxSize(maxSize) {}
+
+    /**
+     * Determine if the complete result has been recorded.
+     *
+     * @return True if the result was small enough to be recorded.
+     */
+    bool recorded() const { return !tooBig; }
+
+    /**
+     * Obtain the recorded result, leaving this recorder empty.
+     *
+     * @return The recorded result.
+     */
+    std::string take() { return std::move(result); }
+
+protected:
+    /** Write a character to the stream and record it */
+    int_type overflow(int_type ch) override;
+
+    /** Write a sequence of characters to the stream and record them */
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+    /** Flush the stream */
+    int sync() override;
+
+private:
+    /** The stream to where the result is written */
+    std::ostream& os;
+
+    /** The size beyond which the result is not recorded */
+    const size_t maxSize;
+
+    /** The result recorded so far */
+    std::string result;
+
+    /** Flag set once the result has exceeded maxSize */
+    bool tooBig = false;
+};
+
+#endif /* RESULT_CACHE_H */
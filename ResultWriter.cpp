@@ -0,0 +1,265 @@
+/* copyright caohd 2023
+ * Implementation of the writer of the rows selected by a query in the
+ * supported output formats.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "Helper.h"
+#include "ResultWriter.h"
+
+// The index of the format in the extensible array (iword) of streams
+static const int formatIdx = std::ios_base::xalloc();
+
+// Append a 32-bit little-endian integer to a binary result
+static void appendU32(std::string& out, const uint32_t val) {
+    const char bytes[4] = {char(val), char(val >> 8), char(val >> 16),
+        char(val >> 24)};
+    out.append(bytes, 4);
+}
+
+// Read a 32-bit little-endian integer from encoded rows
+static uint32_t readU32(const std::string& rowText, const size_t pos) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(
+        rowText.data() + pos);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        (uint32_t(bytes[3]) << 24);
+}
+
+// Read the value at a given position in CELLS rows and move the position
+// to the next value
+static std::string_view readValue(const std::string& rowText, size_t& pos) {
+    const uint32_t len = readU32(rowText, pos);
+    const std::string_view val(rowText.data() + pos + 4, len);
+    pos += 4 + len;
+    return val;
+}
+
+// Convert a value to a double only if the conversion is lossless, i.e.,
+// the value is the shortest representation of the double.
+static bool toDouble(const std::string_view val, double& num) {
+    char buf[32];
+    if (val.empty() || val.size() >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, val.data(), val.size());
+    buf[val.size()] = '\0';
+    char* end;
+    num = strtod(buf, &end);
+    if (end != buf + val.size()) {
+        return false;
+    }
+    char back[32];
+    const int len = snprintf(back, sizeof(back), "%.15g", num);
+    return val == std::string_view(back, len);
+}
+
+// Append a value as a JSON string, escaping only the characters that
+// must be escaped. Runs of characters that need no escaping are appended
+// as a whole.
+static void appendJson(std::string& out, const std::string_view val) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    size_t run = 0;
+    for (size_t i = 0; i < val.size(); i++) {
+        const unsigned char c = val[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(val, run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        }
+    }
+    out.append(val, run, val.size() - run);
+    out += '"';
+}
+
+size_t
+ResultWriter::skipRow(const std::string& rowText, size_t pos,
+        const size_t numCols, const Encoding enc) {
+    if (enc == Encoding::TSV) {
+        return rowText.find('\n', pos) + 1;
+    }
+    for (size_t c = 0; c < numCols; c++) {
+        pos += 4 + readU32(rowText, pos);
+    }
+    return pos;
+}
+
+ResultWriter::Format
+ResultWriter::toFormat(const std::string& name) {
+    if (name == "text") {
+        return Format::TEXT;
+    } else if (name == "binary") {
+        return Format::BINARY;
+    } else if (name == "json") {
+        return Format::JSON;
+    }
+    throw Exp("Invalid format " + name);
+}
+
+std::string
+ResultWriter::contentType(const Format format) {
+    switch (format) {
+    case Format::BINARY: return "application/octet-stream";
+    case Format::JSON:   return "application/json";
+    default:             return "text/html";
+    }
+}
+
+void
+ResultWriter::setFormat(std::ostream& os, const Format format) {
+    os.iword(formatIdx) = static_cast<long>(format);
+}
+
+ResultWriter::Format
+ResultWriter::getFormat(std::ostream& os) {
+    return static_cast<Format>(os.iword(formatIdx));
+}
+
+void
+ResultWriter::writeError(std::ostream& os, const std::string& msg) {
+    if (getFormat(os) == Format::BINARY) {
+        std::string out;
+        appendU32(out, UINT32_MAX);
+        appendU32(out, msg.size());
+        os << out << msg << std::flush;
+    } else if (getFormat(os) == Format::JSON) {
+        std::string out = "{\"error\":";
+        appendJson(out, msg);
+        os << out << "}" << std::endl;
+    } else {
+        os << "Error: " << msg << std::endl;
+    }
+}
+
+ResultWriter::ResultWriter(std::ostream& os, const StrVec& colNames) :
+    os(os), colNames(colNames), format(getFormat(os)) {
+}
+
+void
+ResultWriter::writeHeader() {
+    if (headerDone) {
+        return;
+    }
+    headerDone = true;
+    if (format == Format::BINARY) {
+        std::string out = "SQAB";
+        appendU32(out, colNames.size());
+        for (const auto& name : colNames) {
+            appendU32(out, name.size());
+            out += name;
+        }
+        os << out;
+    } else if (format == Format::JSON) {
+        std::string out = "{\"columns\":[";
+        for (size_t i = 0; i < colNames.size(); i++) {
+            if (i > 0) out += ',';
+            appendJson(out, colNames[i]);
+        }
+        os << out << "],\"rows\":[";
+    } else {
+        os << colNames << '\n';
+    }
+}
+
+void
+ResultWriter::write(const std::string& rowText, const int count) {
+    if (count == 0) {
+        return;
+    }
+    writeHeader();
+    if (format == Format::BINARY) {
+        writeBinary(rowText, count);
+    } else if (format == Format::JSON) {
+        writeJson(rowText, count);
+    } else {
+        os << rowText;
+    }
+    numRows += count;
+}
+
+void
+ResultWriter::writeBinary(const std::string& rowText, const int count) {
+    // Gather the values of each column from the rows
+    const size_t numCols = colNames.size();
+    std::vector<std::vector<std::string_view>> cols(numCols);
+    size_t pos = 0;
+    for (int r = 0; r < count; r++) {
+        for (size_t c = 0; c < numCols; c++) {
+            cols[c].push_back(readValue(rowText, pos));
+        }
+    }
+    std::string out;
+    out.reserve(rowText.size() + 4 * (count * numCols + 1) + numCols);
+    appendU32(out, count);
+    std::vector<double> nums(count);
+    for (const auto& col : cols) {
+        // Columns where every value is a number are written as doubles
+        bool isNum = true;
+        for (int r = 0; r < count && isNum; r++) {
+            isNum = toDouble(col[r], nums[r]);
+        }
+        out += char(isNum ? 1 : 0);
+        if (isNum) {
+            for (const double num : nums) {
+                uint64_t bits;
+                memcpy(&bits, &num, sizeof(bits));
+                appendU32(out, bits);
+                appendU32(out, bits >> 32);
+            }
+        } else {
+            for (const auto& val : col) {
+                appendU32(out, val.size());
+                out.append(val);
+            }
+        }
+    }
+    os << out;
+}
+
+void
+ResultWriter::writeJson(const std::string& rowText, const int count) {
+    // Escaped values are seldom longer than the values themselves
+    std::string out;
+    out.reserve(rowText.size() + count * 4);
+    size_t pos = 0;
+    for (int r = 0; r < count; r++) {
+        out += (numRows + r == 0 ? "\n[" : ",\n[");
+        for (size_t c = 0; c < colNames.size(); c++) {
+            if (c > 0) out += ',';
+            appendJson(out, readValue(rowText, pos));
+        }
+        out += ']';
+    }
+    os << out;
+}
+
+void
+ResultWriter::finish() {
+    if (format == Format::BINARY) {
+        writeHeader();  // The schema is written even if there are no rows
+        std::string out;
+        appendU32(out, 0);
+        os << out << std::flush;
+    } else if (format == Format::JSON) {
+        writeHeader();
+        os << "\n],\"count\":" << numRows << "}" << std::endl;
+    } else {
+        os << std::to_string(numRows) + " row(s) selected." << std::endl;
+    }
+}
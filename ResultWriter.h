@@ -0,0 +1,246 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+/*
+ * The writer of the rows selected by a query in one of the supported
+ * output formats. For the default text format, the rows are produced by
+ * the scans as tab-separated text (one row per line), which is written as
+ * is. For the other formats, the scans produce the exact values of each
+ * row (see Encoding), as values may contain tabs or newlines. Formats
+ * other than text are requested by web-clients via a "format" parameter
+ * in the query string, for example:
+ *
+ *     /sql-air?query=select * from test.csv&format=binary
+ *
+ * The format is attached to the output stream (see setFormat()), so that
+ * it reaches the methods that print the results. Messages from queries
+ * other than select (e.g., "1 row(s) updated.") are always text.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ostream>
+#include "CSV.h"
+
+/**
+ * A writer of the column names and the batches of rows selected by a
+ * query, followed by the number of rows selected.
+ *
+ * The binary format is a compact columnar format where all integers are
+ * little-endian. It has a schema, followed by a batch for each call to
+ * write(), followed by a batch with zero rows:
+ *
+ *     schema: "SQAB" u32:numCols {u32:len name}*
+ *     batch:  u32:numRows column*
+ *     column: u8:1 f64*         -- every value in the batch is a number
+ *           | u8:0 {u32:len bytes}*
+ *
+ * An error ends the output with u32:0xFFFFFFFF u32:len message.
+ *
+ * The JSON format is an object with the column names, the rows (one per
+ * line, with each value as a string), and the number of rows selected:
+ *
+ *     {"columns":["title","year"],"rows":[
+ *     ["Paperman","2012"]
+ *     ],"count":1}
+ *
+ * An error is written as {"error":"message"}.
+ */
+class ResultWriter {
+public:
+    /** The supported output formats */
+    enum class Format { TEXT, BINARY, JSON };
+
+    /**
+     * The encodings of the rows handed to write(). TSV rows have their
+     * values separated by a tab and end with a newline. It is used for the
+     * text format, where the rows are written as is. CELLS rows are just
+     * their values, each preceded by its length as a 32-bit little-endian
+     * integer. It keeps values with tabs or newlines intact for the other
+     * formats.
+     */
+    enum class Encoding { TSV, CELLS };
+
+    /**
+     * Obtain the encoding of the rows for a given format.
+     *
+     * @param format The format in which the rows are written.
+     *
+     * @return TSV for the text format and CELLS for the other formats.
+     */
+    static Encoding getEncoding(const Format format) {
+        return (format == Format::TEXT ? Encoding::TSV : Encoding::CELLS);
+    }
+
+    /**
+     * Append a value of a row to the rows to be written.
+     *
+     * @param rowText The rows to which the value is appended.
+     *
+     * @param val The value to be appended.
+     *
+     * @param first Flag to indicate if this is the first value in the row.
+     *
+     * @param enc The encoding of the rows.
+     */
+    static void appendValue(std::string& rowText, const std::string_view val,
+        const bool first, const Encoding enc) {
+        if (enc == Encoding::TSV) {
+            if (!first) rowText += '\t';
+            rowText += val;
+        } else {
+            const uint32_t len = val.size();
+            const char bytes[4] = {char(len), char(len >> 8),
+                char(len >> 16), char(len >> 24)};
+            rowText.append(bytes, 4);
+            rowText += val;
+        }
+    }
+
+    /**
+     * End a row whose values have been appended via appendValue().
+     *
+     * @param rowText The rows to which the end of the row is appended.
+     *
+     * @param enc The encoding of the rows.
+     */
+    static void endRow(std::string& rowText, const Encoding enc) {
+        if (enc == Encoding::TSV) {
+            rowText += '\n';
+        }
+    }
+
+    /**
+     * Find the end of a row in a set of encoded rows.
+     *
+     * @param rowText The encoded rows.
+     *
+     * @param pos The position at which the row starts.
+     *
+     * @param numCols The number of values in each row.
+     *
+     * @param enc The encoding of the rows.
+     *
+     * @return The position just after the row, i.e., where the next row
+     * starts.
+     */
+    static size_t skipRow(const std::string& rowText, size_t pos,
+        const size_t numCols, const Encoding enc);
+
+    /**
+     * Obtain the format corresponding to the value of the "format"
+     * parameter in a query string.
+     *
+     * @param name The name of the format, e.g., "binary".
+     *
+     * @return The corresponding format.
+     *
+     * @exception Exp This method throws an exception if the format is
+     * not supported.
+     */
+    static Format toFormat(const std::string& name);
+
+    /**
+     * Obtain the value of the HTTP Content-Type header for a format.
+     *
+     * @param format The format of the response.
+     *
+     * @return The content type, e.g., "text/html".
+     */
+    static std::string contentType(const Format format);
+
+    /**
+     * Set the format in which results are written to a given stream.
+     *
+     * @param os The stream to where results are to be written.
+     *
+     * @param format The format of the results.
+     */
+    static void setFormat(std::ostream& os, const Format format);
+
+    /**
+     * Obtain the format in which results are written to a given stream.
+     *
+     * @param os The stream to where results are to be written.
+     *
+     * @return The format set via setFormat() or TEXT if it was not set.
+     */
+    static Format getFormat(std::ostream& os);
+
+    /**
+     * Write an error message in the format of a given stream.
+     *
+     * @param os The stream to where the message is to be written.
+     *
+     * @param msg The error message.
+     */
+    static void writeError(std::ostream& os, const std::string& msg);
+
+    /**
+     * Create a writer for the results of a query.
+     *
+     * @param os The stream to where the results are written. The format
+     * is obtained via getFormat().
+     *
+     * @param colNames The names of the columns in each row.
+     */
+    ResultWriter(std::ostream& os, const StrVec& colNames);
+
+    /**
+     * Write a batch of rows. Nothing is written if the batch is empty.
+     *
+     * @param rowText The rows, in the encoding returned by getEncoding().
+     *
+     * @param count The number of rows in rowText.
+     */
+    void write(const std::string& rowText, const int count);
+
+    /**
+     * Obtain the encoding of the rows to be handed to write().
+     *
+     * @return The encoding of the rows for the format of this writer.
+     */
+    Encoding getEncoding() const { return getEncoding(format); }
+
+    /**
+     * Write the end of the results, i.e., the number of rows selected.
+     */
+    void finish();
+
+    /**
+     * Obtain the number of rows written so far.
+     *
+     * @return The number of rows written via write().
+     */
+    int rowCount() const { return numRows; }
+
+private:
+    /** Write the column names, if they have not been written already */
+    void writeHeader();
+
+    /** Write a batch of rows in the binary format */
+    void writeBinary(const std::string& rowText, const int count);
+
+    /** Write a batch of rows in the JSON format */
+    void writeJson(const std::string& rowText, const int count);
+
+    /** The stream to where the results are written */
+    std::ostream& os;
+
+    /** The names of the columns in each row */
+    const StrVec& colNames;
+
+    /** The format in which the results are written */
+    const Format format;
+
+    /** The number of rows written so far */
+    int numRows = 0;
+
+    /** Flag set once the column names have been written */
+    bool headerDone = false;
+};
+
+#endif /* RESULT_WRITER_H */
@@ -10,9 +10,12 @@
 #include <tuple>
 #include <algorithm>
 #include <memory>
+#include <optional>
+#include <cstdlib>
+#include <sstream>
+#include <strings.h>
 #include "SQLAir.h"
 #include "HTTPFile.h"
-#include <boost/format.hpp>
 
 using namespace boost::asio::ip;
 
@@ -31,58 +34,734 @@ using Guard = std::scoped_lock<std::mutex>;
 
 const std::string HTTPRespHeader = "HTTP/1.1 200 OK\r\n"
     "Server: SimpleServer\r\n"
-    "Content-Length: %1%\r\n"
     "Connection: Close\r\n"
-    "Content-Type: text/html\r\n\r\n";
+    "Content-Type: ";
+
+/**
+ * A convenience class to lock the mutexes of a range of rows in a CSV for
+ * the life time of this object. The rows are always locked in ascending
+ * order. Since other operations lock at most one row at a time, locking a
+ * batch of rows in this manner cannot deadlock.
+ */
+class RowRangeGuard {
+public:
+    RowRangeGuard(CSV& csv, const int start, const int end) :
+        csv(csv), start(start), end(end) {
+        for (int i = start; i < end; i++) {
+            csv[i].rowMutex.lock();
+        }
+    }
+
+    ~RowRangeGuard() {
+        for (int i = start; i < end; i++) {
+            csv[i].rowMutex.unlock();
+        }
+    }
+
+private:
+    CSV& csv;
+    const int start, end;
+};
+
+// Determine the number of threads to be used to process a query
+static int getScanThreads(const int scanThreads) {
+    if (scanThreads > 0) {
+        return scanThreads;
+    }
+    const char* env = std::getenv("SQLAIR_SCAN_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Determine the default deadline of wait queries in milliseconds
+static int getWaitTimeout() {
+    const char* env = std::getenv("SQLAIR_WAIT_TIMEOUT_MS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+    return -1;
+}
+
+// Determine the time until which a wait query may wait, given the timeout
+// of the query and the default timeout of the server
+static WaitList::Clock::time_point getDeadline(const int timeout,
+        const int defTimeout) {
+    const int ms = (timeout != -1 ? timeout : defTimeout);
+    return (ms == -1 ? WaitList::Clock::time_point::max() :
+        WaitList::Clock::now() + std::chrono::milliseconds(ms));
+}
+
+// Determine the number of threads that accept connections and read
+// requests asynchronously. Zero selects the blocking server instead. One
+// thread is enough by default, as these threads never block.
+static int getIoThreads() {
+    const char* env = std::getenv("SQLAIR_IO_THREADS");
+    if (env != nullptr && std::atoi(env) >= 0) {
+        return std::atoi(env);
+    }
+    return 1;
+}
+
+SQLAir::SQLAir(const int scanThreads) : 
+    scanThreads(getScanThreads(scanThreads)), 
+    scanPool(this->scanThreads - 1), waitTimeout(getWaitTimeout()) {
+}
+
+SQLAir::LongLivedSlot::LongLivedSlot(SQLAir& air) : air(air) {
+    Guard g(air.longLivedMutex);
+    if (air.numLongLived >= air.maxLongLived) {
+        throw Exp("Too many wait queries and subscriptions in progress");
+    }
+    air.numLongLived++;
+}
+
+SQLAir::LongLivedSlot::~LongLivedSlot() {
+    Guard g(air.longLivedMutex);
+    air.numLongLived--;
+}
+
+// The chunked output of a request. The last chunk is written once the
+// output is no longer used, i.e., once the request and any wait query or
+// subscription that sleeps without holding a worker are done. If the
+// headers are given, a response that fits in one chunk is sent with a
+// Content-Length header instead.
+struct SQLAir::RequestOutput {
+    RequestOutput(std::ostream& os, const int fd,
+        std::shared_ptr<AsyncServer::Response> response,
+        std::string header = "") : response(std::move(response)),
+        chunkBuf(os, fd, std::move(header)), os(&chunkBuf) {
+    }
+
+    ~RequestOutput() {
+        chunkBuf.finish();
+    }
+
+    /** The response in the asynchronous server, or nullptr otherwise */
+    const std::shared_ptr<AsyncServer::Response> response;
+
+    /** The buffer that writes the chunks to the client */
+    ChunkedStreamBuf chunkBuf;
+
+    /** The stream to where the results are written */
+    std::ostream os;
+};
+
+// A wait query that sleeps without holding a worker. It keeps the output
+// of its request until it is done.
+struct SQLAir::SuspendedQuery {
+    SuspendedQuery(std::shared_ptr<RequestOutput> output, CSV& csv,
+        const QueryPlan& plan, const bool isUpdate, const uint64_t version,
+        const WaitList::Clock::time_point deadline) :
+        output(std::move(output)), csv(csv), plan(plan), isUpdate(isUpdate),
+        version(version), deadline(deadline) {
+    }
+
+    /** The output to where the results are written */
+    const std::shared_ptr<RequestOutput> output;
+
+    /** The CSV on which the query waits */
+    CSV& csv;
+
+    /** The compiled query */
+    const QueryPlan plan;
+
+    /** Flag to indicate if this is a wait update (or a wait select) */
+    const bool isUpdate;
+
+    /** The version of the CSV when the query last checked the CSV */
+    uint64_t version;
+
+    /** The time after which the query gives up */
+    const WaitList::Clock::time_point deadline;
+};
+
+// A subscription to the changes to the rows selected by a query. Its
+// subscriber is registered with the wait list of the CSV until this
+// object is destroyed.
+struct SQLAir::Subscription {
+    Subscription(WaitList& waitList, QueryPlan plan) :
+        waitList(waitList), plan(std::move(plan)), sub(this->plan) {
+    }
+
+    ~Subscription() {
+        waitList.removeSubscriber(sub);
+    }
+
+    /** The slot held if the subscription holds a worker */
+    std::optional<LongLivedSlot> slot;
+
+    /** The wait list of the CSV */
+    WaitList& waitList;
+
+    /** The compiled select query */
+    const QueryPlan plan;
+
+    /** The subscriber registered with the wait list */
+    WaitList::Subscriber sub;
+
+    /** The version of the CSV up to which events have been sent */
+    uint64_t since = 0;
+
+    /** The output of the request, if the subscription sleeps without
+     * holding a worker
+     */
+    std::shared_ptr<RequestOutput> output;
+};
+
+thread_local std::shared_ptr<SQLAir::RequestOutput> SQLAir::currentOutput;
+
+std::shared_ptr<SQLAir::RequestOutput>
+SQLAir::getAsyncOutput(const std::ostream& os) {
+    if (currentOutput && currentOutput->response &&
+        &os == &currentOutput->os) {
+        return currentOutput;
+    }
+    return nullptr;
+}
+
+// Helper method to process the rows in [start, end) in select queries
+int SQLAir::selectRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::string& rowText, int& skip,
+        const int maxRows) {
+    // The selection vector reused for each batch of rows
+    int sel[QueryPlan::BatchSize], rowCount = 0;
+    for (int bStart = start; bStart < end && rowCount < maxRows;
+         bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, end);
+        // lock the rows in the batch
+        RowRangeGuard g(csv, bStart, bEnd);
+        // First determine the rows in this batch that match the "where"
+        // clause condition, if any.
+        int selCount = plan.filter(csv, bStart, bEnd, sel);
+        // Skip the rows covered by an offset and stop at the limit so
+        // that rows which are not printed are never formatted.
+        const int first = std::min(skip, selCount);
+        skip    -= first;
+        selCount = std::min(selCount, first + (maxRows - rowCount));
+        // Then materialize the output columns only for the matched rows.
+        for (int s = first; s < selCount; s++) {
+            plan.appendRow(csv[sel[s]], rowText);
+        }
+        rowCount += selCount - first;
+    }
+    return rowCount;
+}
+
+// Append the rows in text (with numCols values each) to rowText, skipping
+// the first skip rows and appending at most maxRows rows. Both counters
+// are updated accordingly.
+static void appendRows(const std::string& text, const size_t numCols,
+        const ResultWriter::Encoding enc, int& skip, int& maxRows,
+        std::string& rowText) {
+    size_t pos = 0;
+    for (; skip > 0 && pos < text.size(); skip--) {
+        pos = ResultWriter::skipRow(text, pos, numCols, enc);
+    }
+    const size_t begin = pos;
+    for (; maxRows > 0 && pos < text.size(); maxRows--) {
+        pos = ResultWriter::skipRow(text, pos, numCols, enc);
+    }
+    rowText.append(text, begin, pos - begin);
+}
 
 // Helper method to process each row in select queries
-void SQLAir::selectRowProcess(CSV& csv, StrVec colNames, 
-        const int whereColIdx, const std::string& cond, 
-        const std::string& value, 
+void SQLAir::selectRowProcess(CSV& csv, const QueryPlan& plan,
+        ResultWriter& out) {
+    if (plan.aggs.empty() && plan.order.empty()) {
+        streamRowProcess(csv, plan, out);
+        return;
+    }
+    // The other queries produce their rows only after checking all rows
+    std::string rowText;
+    int count = 0;
+    if (!plan.groupCols.empty()) {
+        groupRowProcess(csv, plan, rowText, count);
+    } else if (!plan.aggs.empty()) {
+        aggregateRowProcess(csv, plan, rowText, count);
+    } else {
+        orderedRowProcess(csv, plan, rowText, count);
+    }
+    out.write(rowText, count);
+}
+
+// Helper method to process only the rows changed by updates in select
+// queries that are waiting
+void SQLAir::selectChangedProcess(CSV& csv, const QueryPlan& plan,
+        const std::vector<int>& rows, ResultWriter& out) {
+    if (!plan.aggs.empty() || !plan.order.empty() || plan.offset != 0) {
+        // The changed rows only tell if the result may have changed. If
+        // none of them match, the result is still empty.
+        const bool anyMatch = std::any_of(rows.begin(), rows.end(),
+            [&](const int r) {
+                Guard g(csv[r].rowMutex);
+                return plan.matches(csv[r]);
+            });
+        if (anyMatch) {
+            selectRowProcess(csv, plan, out);
+        }
+        return;
+    }
+    // No rows matched before waiting. So the changed rows are the only
+    // rows that can match now.
+    std::string rowText;
+    const int limit = (plan.limit == -1 ? INT_MAX : plan.limit);
+    int skip = 0, maxRows = limit;
+    for (size_t i = 0; i < rows.size() && maxRows > 0; i++) {
+        maxRows -= selectRangeProcess(csv, plan, rows[i], rows[i] + 1,
+            rowText, skip, maxRows);
+    }
+    out.write(rowText, limit - maxRows);
+}
+
+// Helper method to stream the rows selected by plain select queries
+void SQLAir::streamRowProcess(CSV& csv, const QueryPlan& plan,
+        ResultWriter& out) {
+    const int numRows = csv.size();
+    const int numMorsels = (numRows + MorselSize - 1) / MorselSize;
+    int skip = plan.offset, maxRows = (plan.limit == -1 ? INT_MAX :
+        plan.limit);
+    std::string rowText;
+    if (numMorsels <= 1 || scanThreads == 1) {
+        // Not worth handing off work to other threads. The rows of each
+        // morsel are written as soon as the morsel has been processed.
+        for (int start = 0; start < numRows && maxRows > 0;
+             start += MorselSize) {
+            const int end   = std::min(start + MorselSize, numRows);
+            const int count = selectRangeProcess(csv, plan, start, end,
+                rowText, skip, maxRows);
+            out.write(rowText, count);
+            maxRows -= count;
+            rowText.clear();
+        }
+        return;
+    }
+    // Have the shared pool process a window of morsels at a time into
+    // separate results which are then written in row order. So only the
+    // rows of one window are buffered. With a limit, once the morsels
+    // finished so far (in row order) have enough rows, the morsels after
+    // them are no longer needed and are skipped.
+    const int window = std::min(numMorsels, StreamWindow * scanThreads);
+    std::vector<std::string> morselText(window);
+    std::vector<int> morselCount(window);
+    std::vector<bool> finished(window);
+    std::mutex prefixMutex;
+    for (int first = 0; first < numMorsels && maxRows > 0; first += window) {
+        const int numWinMorsels = std::min(window, numMorsels - first);
+        // The number of matching rows after which the scan can stop
+        const int needed = (maxRows > INT_MAX - skip ? INT_MAX :
+            skip + maxRows);
+        std::atomic<int> lastMorsel = {numWinMorsels - 1};
+        int prefixEnd = 0, prefixCount = 0;
+        std::fill(finished.begin(), finished.end(), false);
+        scanPool.parallelFor(numWinMorsels, scanThreads, [&](const int m) {
+            if (m > lastMorsel) {
+                return;
+            }
+            const int start = (first + m) * MorselSize;
+            const int end   = std::min(start + MorselSize, numRows);
+            int noSkip = 0;
+            morselCount[m]  = selectRangeProcess(csv, plan, start, end,
+                morselText[m], noSkip, needed);
+            if (needed != INT_MAX) {
+                Guard g(prefixMutex);
+                finished[m] = true;
+                while (prefixCount < needed && prefixEnd < numWinMorsels &&
+                       finished[prefixEnd]) {
+                    prefixCount += morselCount[prefixEnd++];
+                }
+                if (prefixCount >= needed) {
+                    lastMorsel = prefixEnd - 1;
+                }
+            }
+        });
+        for (int m = 0; m <= lastMorsel && maxRows > 0; m++) {
+            if (skip == 0 && morselCount[m] <= maxRows) {
+                out.write(morselText[m], morselCount[m]);
+                maxRows -= morselCount[m];
+            } else {
+                const int before = maxRows;
+                appendRows(morselText[m], plan.colIdx.size(), plan.encoding,
+                    skip, maxRows, rowText);
+                out.write(rowText, before - maxRows);
+                rowText.clear();
+            }
+        }
+        // Keep the memory of the buffers for the next window
+        for (auto& text : morselText) {
+            text.clear();
+        }
+    }
+}
+
+// Helper method to collect the selected rows in [start, end) in select
+// queries with an order by clause
+void SQLAir::orderedRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, OrderedRows& rows) {
+    int sel[QueryPlan::BatchSize];
+    for (int bStart = start; bStart < end; bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, end);
+        RowRangeGuard g(csv, bStart, bEnd);
+        const int selCount = plan.filter(csv, bStart, bEnd, sel);
+        for (int s = 0; s < selCount; s++) {
+            const CSVRow& row = csv[sel[s]];
+            const std::string& key = row[plan.order.colIdx];
+            OrderedRow oRow{key, WhereExpr::toNumber(key), sel[s], ""};
+            // Only format rows that make it into a bounded (top-k) list
+            if (rows.accepts(oRow)) {
+                plan.appendRow(row, oRow.text);
+                rows.add(std::move(oRow));
+            }
+        }
+    }
+    rows.sort();
+}
+
+// Helper method to process each row in select queries with an order by
+// clause. With a limit, each thread keeps just the best (offset + limit)
+// rows in a heap. Otherwise, each morsel is sorted separately and the
+// sorted morsels are merged pair-wise in parallel.
+void SQLAir::orderedRowProcess(CSV& csv, const QueryPlan& plan,
         std::string& rowText, int& rowCount) {
-    for (auto& row : csv) {
-        // lock the row
-        Guard g(row.rowMutex);
-        // Determine if this row matches "where" clause condition, if any
-        // see SQLAirBase::matches() helper method.
-        bool isMatch  = (whereColIdx == -1) ? true : 
-        matches(row.at(whereColIdx), cond, value);
-        
-        if (isMatch) {
-            std::string delim = "";
-            for (auto& colName : colNames) {
-                std::string cell;
-                cell = row.at(csv.getColumnIndex(colName));
-                rowText += delim + cell;
-                delim = "\t";
+    const int numRows = csv.size();
+    const int numMorsels = std::max(1, (numRows + MorselSize - 1) /
+        MorselSize);
+    const int limit  = (plan.limit == -1 ? INT_MAX : plan.limit);
+    const int needed = (limit > INT_MAX - plan.offset ? INT_MAX :
+        plan.offset + limit);
+    const bool sequential = (numMorsels == 1 || scanThreads == 1);
+    std::vector<OrderedRows> runs(sequential ? 1 : numMorsels,
+        OrderedRows(plan.order, needed));
+    if (sequential) {
+        orderedRangeProcess(csv, plan, 0, numRows, runs[0]);
+    } else {
+        scanPool.parallelFor(numMorsels, scanThreads, [&](const int m) {
+            const int start = m * MorselSize;
+            const int end   = std::min(start + MorselSize, numRows);
+            orderedRangeProcess(csv, plan, start, end, runs[m]);
+        });
+    }
+    // Merge pairs of sorted runs until just one run is left
+    for (int step = 1; step < static_cast<int>(runs.size()); step *= 2) {
+        const int pairs = (runs.size() + 2 * step - 1) / (2 * step);
+        scanPool.parallelFor(pairs, scanThreads, [&](const int p) {
+            const size_t first = 2 * p * step, second = first + step;
+            if (second < runs.size()) {
+                runs[first].merge(runs[second]);
             }
-            // os << std::endl;
-            rowText += "\n";
-            rowCount++;
+        });
+    }
+    // Print the rows after the offset, up to the limit
+    const auto& rows = runs[0].rows;
+    int printed = 0;
+    for (size_t i = plan.offset; i < rows.size() && printed < limit; i++) {
+        rowText += rows[i].text;
+        printed++;
+    }
+    rowCount += printed;
+}
+
+// Helper method to compute partial aggregates for the selected rows in
+// [start, end) without formatting any of the rows
+void SQLAir::aggregateRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::vector<AggState>& states) {
+    int sel[QueryPlan::BatchSize];
+    for (int bStart = start; bStart < end; bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, end);
+        RowRangeGuard g(csv, bStart, bEnd);
+        const int selCount = plan.filter(csv, bStart, bEnd, sel);
+        for (size_t i = 0; i < plan.aggs.size(); i++) {
+            states[i].add(plan.aggs[i], csv, sel, selCount);
         }
     }
 }
 
-// Helper method to process each row in update queries
-void SQLAir::updateRowProcess(CSV& csv, StrVec colNames,  StrVec values, 
-        const int whereColIdx, const std::string& cond, 
-        const std::string& value, int& rowCount) {
-    for (auto& row : csv) {
+// Helper method to process each row in select queries with aggregates.
+// Each morsel is aggregated separately and the partial aggregates are
+// merged at the end.
+void SQLAir::aggregateRowProcess(CSV& csv, const QueryPlan& plan,
+        std::string& rowText, int& rowCount) {
+    const int numRows = csv.size();
+    const int numMorsels = (numRows + MorselSize - 1) / MorselSize;
+    std::vector<AggState> states(plan.aggs.size());
+    if (numMorsels <= 1 || scanThreads == 1) {
+        aggregateRangeProcess(csv, plan, 0, numRows, states);
+    } else {
+        std::vector<std::vector<AggState>> partials(numMorsels, states);
+        scanPool.parallelFor(numMorsels, scanThreads, [&](const int m) {
+            const int start = m * MorselSize;
+            const int end   = std::min(start + MorselSize, numRows);
+            aggregateRangeProcess(csv, plan, start, end, partials[m]);
+        });
+        for (const auto& partial : partials) {
+            for (size_t i = 0; i < plan.aggs.size(); i++) {
+                states[i].merge(plan.aggs[i], partial[i]);
+            }
+        }
+    }
+    // Aggregates always produce a single row, subject to limit & offset
+    if (plan.offset > 0 || plan.limit == 0) {
+        return;
+    }
+    for (size_t i = 0; i < plan.aggs.size(); i++) {
+        ResultWriter::appendValue(rowText, states[i].result(plan.aggs[i]),
+            i == 0, plan.encoding);
+    }
+    ResultWriter::endRow(rowText, plan.encoding);
+    rowCount++;
+}
+
+// Helper method to add the selected rows in [start, end) to partitioned
+// hash tables of groups without formatting any of the rows
+void SQLAir::groupRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::vector<AggTable>& parts) {
+    int sel[QueryPlan::BatchSize];
+    std::string key;  // Reused to avoid allocations for each row
+    for (int bStart = start; bStart < end; bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, end);
+        RowRangeGuard g(csv, bStart, bEnd);
+        const int selCount = plan.filter(csv, bStart, bEnd, sel);
+        for (int s = 0; s < selCount; s++) {
+            const CSVRow& row = csv[sel[s]];
+            key.clear();
+            for (const int col : plan.groupCols) {
+                key += row[col];
+                key += '\0';
+            }
+            auto& table = parts[std::hash<std::string>{}(key) % parts.size()];
+            auto entry  = table.find(key);
+            if (entry == table.end()) {
+                AggGroup group{sel[s], {}, std::vector<AggState>(
+                    plan.aggs.size())};
+                for (const int col : plan.groupCols) {
+                    group.keys.push_back(row[col]);
+                }
+                entry = table.emplace(key, std::move(group)).first;
+            }
+            auto& states = entry->second.states;
+            for (size_t i = 0; i < plan.aggs.size(); i++) {
+                if (plan.aggs[i].func != AggSpec::Func::VALUE) {
+                    states[i].add(plan.aggs[i], row);
+                }
+            }
+        }
+    }
+}
+
+// Helper method to process each row in select queries with a group by
+// clause. Each morsel builds its own hash tables of groups, partitioned by
+// the hash of the group keys. Each partition is then merged across the
+// morsels independently (and in parallel).
+void SQLAir::groupRowProcess(CSV& csv, const QueryPlan& plan,
+        std::string& rowText, int& rowCount) {
+    const int numRows = csv.size();
+    const int numMorsels = (numRows + MorselSize - 1) / MorselSize;
+    const bool sequential = (numMorsels <= 1 || scanThreads == 1);
+    const int numParts = (sequential ? 1 : scanThreads);
+    std::vector<std::vector<AggTable>> partials(sequential ? 1 : numMorsels,
+        std::vector<AggTable>(numParts));
+    if (sequential) {
+        groupRangeProcess(csv, plan, 0, numRows, partials[0]);
+    } else {
+        scanPool.parallelFor(numMorsels, scanThreads, [&](const int m) {
+            const int start = m * MorselSize;
+            const int end   = std::min(start + MorselSize, numRows);
+            groupRangeProcess(csv, plan, start, end, partials[m]);
+        });
+        // Merge each partition into the tables of the first morsel
+        scanPool.parallelFor(numParts, scanThreads, [&](const int p) {
+            AggTable& table = partials[0][p];
+            for (int m = 1; m < numMorsels; m++) {
+                for (auto& [key, group] : partials[m][p]) {
+                    auto entry = table.find(key);
+                    if (entry == table.end()) {
+                        table.emplace(key, std::move(group));
+                        continue;
+                    }
+                    AggGroup& dest = entry->second;
+                    dest.firstRow = std::min(dest.firstRow, group.firstRow);
+                    for (size_t i = 0; i < plan.aggs.size(); i++) {
+                        dest.states[i].merge(plan.aggs[i], group.states[i]);
+                    }
+                }
+                partials[m][p].clear();
+            }
+        });
+    }
+    // Order the groups by the order by column (which must be in the group
+    // by clause), or else in the order in which they first appear. Only
+    // the groups that are printed are formatted.
+    const int limit  = (plan.limit == -1 ? INT_MAX : plan.limit);
+    const int needed = (limit > INT_MAX - plan.offset ? INT_MAX :
+        plan.offset + limit);
+    const int orderKey = std::find(plan.groupCols.begin(),
+        plan.groupCols.end(), plan.order.colIdx) - plan.groupCols.begin();
+    OrderedRows groups(plan.order, needed);
+    for (const auto& table : partials[0]) {
+        for (const auto& entry : table) {
+            const AggGroup& group = entry.second;
+            const std::string& key = (plan.order.empty() ? "" :
+                group.keys[orderKey]);
+            OrderedRow oRow{key, WhereExpr::toNumber(key), group.firstRow,
+                ""};
+            if (!groups.accepts(oRow)) {
+                continue;
+            }
+            for (size_t i = 0; i < plan.aggs.size(); i++) {
+                const AggSpec& spec = plan.aggs[i];
+                ResultWriter::appendValue(oRow.text,
+                    (spec.func == AggSpec::Func::VALUE ?
+                    group.keys[spec.colIdx] : group.states[i].result(spec)),
+                    i == 0, plan.encoding);
+            }
+            ResultWriter::endRow(oRow.text, plan.encoding);
+            groups.add(std::move(oRow));
+        }
+    }
+    groups.sort();
+    int printed = 0;
+    for (size_t i = plan.offset; i < groups.rows.size() && printed < limit;
+         i++, printed++) {
+        rowText += groups.rows[i].text;
+    }
+    rowCount += printed;
+}
+
+// Helper method to build the hash table for a join. The values of the
+// selected columns are copied so that the probe does not lock these rows.
+void SQLAir::joinBuildProcess(CSV& csv, const QueryPlan& plan,
+        const int keyCol, JoinTable& table) {
+    int sel[QueryPlan::BatchSize];
+    const int numRows = csv.size();
+    for (int bStart = 0; bStart < numRows; bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, numRows);
+        RowRangeGuard g(csv, bStart, bEnd);
+        const int selCount = plan.filter(csv, bStart, bEnd, sel);
+        for (int s = 0; s < selCount; s++) {
+            const CSVRow& row = csv[sel[s]];
+            StrVec vals;
+            vals.reserve(plan.colIdx.size());
+            for (const int col : plan.colIdx) {
+                vals.push_back(row[col]);
+            }
+            table[row[keyCol]].push_back(std::move(vals));
+        }
+    }
+}
+
+// Helper method to probe the hash table of a join with the rows in
+// [start, end) on the probe side
+int SQLAir::joinRangeProcess(CSV& csv, const JoinPlan& plan, const int probe,
+        const JoinTable& table, const int start, const int end,
+        std::string& rowText, int skip, const int maxRows) {
+    const QueryPlan& probePlan = plan.sides[probe];
+    int sel[QueryPlan::BatchSize], rowCount = 0;
+    for (int bStart = start; bStart < end && rowCount < maxRows;
+         bStart += QueryPlan::BatchSize) {
+        const int bEnd = std::min(bStart + QueryPlan::BatchSize, end);
+        RowRangeGuard g(csv, bStart, bEnd);
+        const int selCount = probePlan.filter(csv, bStart, bEnd, sel);
+        for (int s = 0; s < selCount && rowCount < maxRows; s++) {
+            const CSVRow& row = csv[sel[s]];
+            const auto entry = table.find(row[plan.keyCol[probe]]);
+            if (entry == table.end()) {
+                continue;
+            }
+            for (const StrVec& vals : entry->second) {
+                if (skip > 0) {
+                    skip--;
+                    continue;
+                }
+                if (rowCount == maxRows) {
+                    break;
+                }
+                for (size_t i = 0; i < plan.outCols.size(); i++) {
+                    const JoinPlan::OutCol& out = plan.outCols[i];
+                    ResultWriter::appendValue(rowText, (out.side == probe ?
+                        row[probePlan.colIdx[out.pos]] : vals[out.pos]),
+                        i == 0, plan.encoding);
+                }
+                ResultWriter::endRow(rowText, plan.encoding);
+                rowCount++;
+            }
+        }
+    }
+    return rowCount;
+}
+
+// Helper method to process the rows in [start, end) in update queries
+int SQLAir::updateRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::vector<int>& changed,
+        const MaterializedViews& views) {
+    int rowCount = 0;
+    for (int r = start; r < end; r++) {
+        CSVRow& row = csv[r];
         // Determine if this row matches "where" clause condition, if any
-        // see SQLAirBase::matches() helper method.
+        // using the condition pre-resolved in the plan.
         Guard g(row.rowMutex);
-        bool isMatch;
-        if (whereColIdx != -1) {
-            isMatch = matches(row.at(whereColIdx), cond, value);
-        }
-        if (whereColIdx == -1 || isMatch) {
-            for (size_t i = 0; i < colNames.size(); i++) {
+        if (plan.matches(row)) {
+            // The old values are needed only to maintain views
+            const CSVRow oldRow = (views.empty() ? CSVRow() : row);
+            for (size_t i = 0; i < plan.colIdx.size(); i++) {
                 // update each cell
-                row.at(csv.getColumnIndex(colNames[i])) = values.at(i);
+                row[plan.colIdx[i]] = plan.values[i];
+            }
+            // Apply the change to the views while the row is still locked
+            // so that changes to a row reach the views in order.
+            for (const auto& view : views) {
+                view->rowChanged(r, oldRow, row);
             }
+            changed.push_back(r);
             rowCount++;
         }
-    }        
+    }
+    return rowCount;
+}
+
+// Helper method to process only the rows changed by other updates in
+// update queries that are waiting
+void SQLAir::updateChangedProcess(CSV& csv, const QueryPlan& plan,
+        const std::vector<int>& rows, int& rowCount,
+        std::vector<int>& changed) {
+    std::shared_lock<std::shared_mutex> updating(viewsUpdateMutex);
+    const MaterializedViews views = getViews(csv);
+    for (const int r : rows) {
+        rowCount += updateRangeProcess(csv, plan, r, r + 1, changed, views);
+    }
+}
+
+// Helper method to process each row in update queries
+void SQLAir::updateRowProcess(CSV& csv, const QueryPlan& plan, 
+        int& rowCount, std::vector<int>& changed) {
+    // Snapshot the views of the CSV. A view cannot be registered until
+    // this query is done, so build() sees all of the changes made here.
+    std::shared_lock<std::shared_mutex> updating(viewsUpdateMutex);
+    const MaterializedViews views = getViews(csv);
+    const int numRows = csv.size();
+    const int numMorsels = (numRows + MorselSize - 1) / MorselSize;
+    if (numMorsels <= 1 || scanThreads == 1) {
+        rowCount += updateRangeProcess(csv, plan, 0, numRows, changed,
+            views);
+        return;
+    }
+    // Have the shared pool update partitions of the CSV. Each row is
+    // still locked while it is checked and updated, and the per-partition
+    // counts and changed rows are added up once all the partitions are
+    // done.
+    std::vector<int> morselCount(numMorsels);
+    std::vector<std::vector<int>> morselChanged(numMorsels);
+    scanPool.parallelFor(numMorsels, scanThreads, [&](const int m) {
+        const int start = m * MorselSize;
+        const int end   = std::min(start + MorselSize, numRows);
+        morselCount[m]  = updateRangeProcess(csv, plan, start, end,
+            morselChanged[m], views);
+    });
+    for (int m = 0; m < numMorsels; m++) {
+        rowCount += morselCount[m];
+        changed.insert(changed.end(), morselChanged[m].begin(),
+            morselChanged[m].end());
+    }
 }
 
 // API method to perform operations associated with a "select" statement
@@ -90,59 +769,820 @@ void SQLAir::updateRowProcess(CSV& csv, StrVec colNames,  StrVec values,
 void SQLAir::selectQuery(CSV& csv, bool mustWait, StrVec colNames, 
         const int whereColIdx, const std::string& cond, 
         const std::string& value, std::ostream& os) {
-    // Convert any "*" to suitable column names. See CSV::getColumnNames() 
-    if (colNames[0] == "*") colNames = csv.getColumnNames();
+    // Compile the validated query once so each row only does indexed
+    // accesses. The plan also converts any "*" to suitable column names.
+    QueryPlan plan(csv, std::move(colNames), whereColIdx, cond, value);
+    plan.encoding = ResultWriter::getEncoding(ResultWriter::getFormat(os));
+    runSelect(csv, mustWait, plan, os);
+}
 
-    // First print the column names.
-    // os << colNames << std::endl;
+// Print the rows selected by a compiled select query
+void SQLAir::runSelect(CSV& csv, bool mustWait, const QueryPlan& plan,
+        std::ostream& os) {
+    // Print each row that matches an optional condition. Nothing is
+    // printed until at least one row has been selected.
+    ResultWriter out(os, plan.colNames);
+    // The version is read before the rows are checked so that updates
+    // made during or after the check are not missed by the wait below.
+    WaitList& waitList = getWaitList(csv);
+    uint64_t version = (mustWait ? waitList.getVersion() : 0);
+    const auto deadline = getDeadline(plan.timeout, waitTimeout);
+    selectRowProcess(csv, plan, out);
+    const auto output = (mustWait && out.rowCount() == 0 ?
+        getAsyncOutput(os) : nullptr);
+    if (output) {
+        // Sleep without holding this thread. The query then continues
+        // in resumeQuery().
+        suspendQuery(std::make_shared<SuspendedQuery>(output, csv, plan,
+            false, version, deadline));
+        return;
+    }
+    // A slot is taken only if the query has to sleep
+    std::optional<LongLivedSlot> slot;
+    while (out.rowCount() == 0 && mustWait) {
+        // Sleep until an update changes a row that matches the where
+        // clause, as only then can rows be selected. Then recheck just
+        // the rows changed in the meantime, if they are known.
+        if (!slot) {
+            slot.emplace(*this);
+        }
+        std::vector<int> changed;
+        const auto outcome = waitList.wait(plan, version, changed, deadline);
+        if (outcome == WaitList::Outcome::TIMEOUT) {
+            break;  // No rows are selected
+        } else if (outcome == WaitList::Outcome::CHANGED) {
+            selectChangedProcess(csv, plan, changed, out);
+        } else {
+            selectRowProcess(csv, plan, out);
+        }
+    }
+    out.finish();
+}
 
-    // row count
+// Print the rows selected by a compiled join query
+void
+SQLAir::runJoin(CSV& left, CSV& right, const JoinPlan& plan,
+        std::ostream& os) {
+    // Build the hash table on the smaller CSV and probe it with the other
+    CSV* csvs[2] = {&left, &right};
+    const int build = (right.size() <= left.size() ? 1 : 0), probe = 1 - build;
+    JoinTable table;
+    joinBuildProcess(*csvs[build], plan.sides[build], plan.keyCol[build],
+        table);
+    CSV& csv = *csvs[probe];
+    const int numRows = csv.size();
+    const int numMorsels = (numRows + MorselSize - 1) / MorselSize;
+    const int limit  = (plan.limit == -1 ? INT_MAX : plan.limit);
+    const int needed = (limit > INT_MAX - plan.offset ? INT_MAX :
+        plan.offset + limit);
     int rowCount = 0;
     std::string rowText;
-    // Print each row that matches an optional condition.
-    selectRowProcess(csv, colNames, whereColIdx, cond, value, rowText, 
-            rowCount);
-    while (rowCount == 0 && mustWait) {
-        // unique lock
-        std::unique_lock<std::mutex> lock(csv.csvMutex);
-        csv.csvCondVar.wait(lock);
-        selectRowProcess(csv, colNames, whereColIdx, cond, value, rowText, 
-            rowCount);  // critical section
-        if (rowCount != 0) {
-            mustWait = false;
+    if (numMorsels <= 1 || scanThreads == 1) {
+        rowCount = joinRangeProcess(csv, plan, probe, table, 0, numRows,
+            rowText, plan.offset, limit);
+    } else {
+        // Probe morsels in parallel. Each morsel needs at most the number
+        // of rows up to the limit. The offset & limit are then applied
+        // while concatenating the morsels in row order.
+        std::vector<std::string> morselText(numMorsels);
+        std::vector<int> morselCount(numMorsels);
+        scanPool.parallelFor(numMorsels, scanThreads, [&](const int m) {
+            const int start = m * MorselSize;
+            const int end   = std::min(start + MorselSize, numRows);
+            morselCount[m]  = joinRangeProcess(csv, plan, probe, table,
+                start, end, morselText[m], 0, needed);
+        });
+        int skip = plan.offset, maxRows = limit;
+        for (int m = 0; m < numMorsels && maxRows > 0; m++) {
+            appendRows(morselText[m], plan.colNames.size(), plan.encoding,
+                skip, maxRows, rowText);
         }
+        rowCount = limit - maxRows;
     }
-    if (rowCount != 0) os << colNames << std::endl;
-    os << rowText <<std::to_string(rowCount) + " row(s) selected." << std::endl;
+    ResultWriter out(os, plan.colNames);
+    out.write(rowText, rowCount);
+    out.finish();
 }
 
 void
 SQLAir::updateQuery(CSV& csv, bool mustWait, StrVec colNames, StrVec values, 
         const int whereColIdx, const std::string& cond, 
         const std::string& value, std::ostream& os)  {
-    // row count
+    // Compile the validated query once to resolve column indices
+    runUpdate(csv, mustWait, QueryPlan(csv, std::move(colNames), whereColIdx,
+        cond, value, std::move(values)), os);
+}
+
+// Update the rows that match a compiled update query
+void
+SQLAir::runUpdate(CSV& csv, bool mustWait, const QueryPlan& plan,
+        std::ostream& os) {
+    // row count and the indices of the rows changed
     int rowCount = 0;
+    std::vector<int> changed;
 
+    // The version is read before the rows are checked so that updates
+    // made during or after the check are not missed by the wait below.
+    WaitList& waitList = getWaitList(csv);
+    uint64_t version = (mustWait ? waitList.getVersion() : 0);
+    const auto deadline = getDeadline(plan.timeout, waitTimeout);
     // Print each row that matches an optional condition.
-    updateRowProcess(csv, colNames, values, 
-            whereColIdx, cond, value, rowCount);
+    updateRowProcess(csv, plan, rowCount, changed);
+    const auto output = (mustWait && rowCount == 0 ?
+        getAsyncOutput(os) : nullptr);
+    if (output) {
+        // Sleep without holding this thread. The query then continues
+        // in resumeQuery().
+        suspendQuery(std::make_shared<SuspendedQuery>(output, csv, plan,
+            true, version, deadline));
+        return;
+    }
+    // A slot is taken only if the query has to sleep
+    std::optional<LongLivedSlot> slot;
     while (rowCount == 0 && mustWait) {
-        // unique lock
-        std::unique_lock<std::mutex> lock(csv.csvMutex);
-        csv.csvCondVar.wait(lock);
-        updateRowProcess(csv, colNames, values, 
-            whereColIdx, cond, value , rowCount);  // critical section
-
-        if (rowCount != 0) { 
-            mustWait = false;
+        // Sleep until another update changes a row that matches the
+        // where clause, as only then can rows be updated. Then recheck
+        // just the rows changed in the meantime, if they are known.
+        if (!slot) {
+            slot.emplace(*this);
+        }
+        std::vector<int> others;
+        const auto outcome = waitList.wait(plan, version, others, deadline);
+        if (outcome == WaitList::Outcome::TIMEOUT) {
+            break;  // No rows are updated
+        } else if (outcome == WaitList::Outcome::CHANGED) {
+            updateChangedProcess(csv, plan, others, rowCount, changed);
+        } else {
+            updateRowProcess(csv, plan, rowCount, changed);
         }
     }
+    finishUpdate(csv, rowCount, changed, os);
+}
+
+void
+SQLAir::finishUpdate(CSV& csv, const int rowCount,
+        const std::vector<int>& changed, std::ostream& os) {
     if (rowCount != 0) { 
-        csv.csvCondVar.notify_all();
+        resultCache.bump(csv);
+        // Wake up only the waiters that the changed rows may satisfy
+        getWaitList(csv).notify(csv, changed);
     }
     os << std::to_string(rowCount) + " row(s) updated." << std::endl;
 }
 
+void
+SQLAir::suspendQuery(const std::shared_ptr<SuspendedQuery>& query) {
+    // The callback must not block. So it just hands the query back to
+    // the response, which continues it on a compute thread.
+    getWaitList(query->csv).waitAsync(query->plan, query->version,
+        query->deadline, [this, query](const WaitList::Outcome outcome,
+            const uint64_t version, const std::vector<int>& changed) {
+            query->output->response->resume(
+                [this, query, outcome, version, changed] {
+                    resumeQuery(query, outcome, version, changed);
+                });
+        });
+}
+
+void
+SQLAir::resumeQuery(const std::shared_ptr<SuspendedQuery>& query,
+        const WaitList::Outcome outcome, const uint64_t version,
+        const std::vector<int>& changed) {
+    using Outcome = WaitList::Outcome;
+    std::ostream& os = query->output->os;
+    query->version = version;
+    try {
+        // Recheck just the changed rows, if they are known, as in the
+        // loops of runSelect() and runUpdate().
+        if (query->isUpdate) {
+            int rowCount = 0;
+            std::vector<int> rows;
+            if (outcome == Outcome::CHANGED) {
+                updateChangedProcess(query->csv, query->plan, changed,
+                    rowCount, rows);
+            } else if (outcome == Outcome::UNKNOWN) {
+                updateRowProcess(query->csv, query->plan, rowCount, rows);
+            }
+            if (rowCount == 0 && outcome != Outcome::TIMEOUT) {
+                suspendQuery(query);
+            } else {
+                finishUpdate(query->csv, rowCount, rows, os);
+            }
+            return;
+        }
+        ResultWriter out(os, query->plan.colNames);
+        if (outcome == Outcome::CHANGED) {
+            selectChangedProcess(query->csv, query->plan, changed, out);
+        } else if (outcome == Outcome::UNKNOWN) {
+            selectRowProcess(query->csv, query->plan, out);
+        }
+        if (out.rowCount() == 0 && outcome != Outcome::TIMEOUT) {
+            suspendQuery(query);
+        } else {
+            out.finish();
+        }
+    } catch (const std::exception &exp) {
+        ResultWriter::writeError(os, exp.what());
+    }
+}
+
+// Obtain the non-negative number of rows in a limit or offset clause
+static int getRowCount(const StrVec& sql, size_t& idx,
+        const std::string& clause) {
+    const std::string num = (idx < sql.size() ? sql[idx++] : "");
+    if (num.empty() || num.size() > 9 ||
+        num.find_first_not_of("0123456789") != std::string::npos) {
+        throw Exp("Invalid " + clause + " clause in select query");
+    }
+    return std::stoi(num);
+}
+
+// Remove an optional "timeout ms" clause at the end of a query and obtain
+// the timeout in milliseconds, or -1 if the query has no timeout clause.
+// Only wait queries may have a timeout.
+static int getTimeout(StrVec& sql, const bool mustWait) {
+    if (sql.size() < 2 || sql[sql.size() - 2] != "timeout") {
+        return -1;
+    }
+    if (!mustWait) {
+        throw Exp("Timeout clause is valid only in wait queries");
+    }
+    const std::string& num = sql.back();
+    if (num.empty() || num.size() > 9 ||
+        num.find_first_not_of("0123456789") != std::string::npos) {
+        throw Exp("Invalid timeout clause " + num);
+    }
+    const int timeout = std::stoi(num);
+    sql.resize(sql.size() - 2);
+    return timeout;
+}
+
+// Obtain an aggregate of the form "func ( col )" in a select list. On
+// return, idx is the index of the closing parenthesis.
+static AggSpec getAggregate(const CSV& csv, const StrVec& sql, size_t& idx,
+        const AggSpec::Func func) {
+    if (idx + 3 >= sql.size() || sql[idx + 3] != ")") {
+        throw Exp("Invalid aggregate " + sql[idx] + " in select query");
+    }
+    const std::string& col = sql[idx + 2];
+    const int colIdx = (col == "*" ? -1 : csv.getColumnIndex(col));
+    if (colIdx == -1 && (col != "*" || func != AggSpec::Func::COUNT)) {
+        throw Exp("Invalid column " + col + " in aggregate " + sql[idx]);
+    }
+    idx += 3;
+    return AggSpec(func, colIdx);
+}
+
+// Obtain the indices of the columns in a group by clause
+static std::vector<int> getGroupCols(const CSV& csv, const StrVec& sql,
+        size_t& idx) {
+    if (idx + 1 >= sql.size() || sql[idx++] != "by") {
+        throw Exp("Invalid group by clause in select query");
+    }
+    std::vector<int> groupCols;
+    for (; idx < sql.size() && sql[idx] != "order" && sql[idx] != "limit";
+         idx++) {
+        const int colIdx = csv.getColumnIndex(sql[idx]);
+        if (colIdx == -1) {
+            throw Exp("Invalid column " + sql[idx] + " in group by clause.");
+        }
+        groupCols.push_back(colIdx);
+    }
+    return groupCols;
+}
+
+// Obtain the column and direction in an order by clause
+static RowOrder getOrder(const CSV& csv, const StrVec& sql, size_t& idx) {
+    if (idx + 1 >= sql.size() || sql[idx] != "by") {
+        throw Exp("Invalid order by clause in select query");
+    }
+    const std::string& col = sql[idx + 1];
+    const int colIdx = csv.getColumnIndex(col);
+    if (colIdx == -1) {
+        throw Exp("Invalid column " + col + " in order by clause.");
+    }
+    idx += 2;
+    const bool desc = (idx < sql.size() && sql[idx] == "desc");
+    if (idx < sql.size() && (desc || sql[idx] == "asc")) {
+        idx++;
+    }
+    return RowOrder(colIdx, desc);
+}
+
+// Obtain the materialized views defined on a CSV
+MaterializedViews
+SQLAir::getViews(const CSV& csv) {
+    Guard g(viewsMutex);
+    const auto entry = csvViews.find(&csv);
+    return (entry == csvViews.end() ? MaterializedViews() : entry->second);
+}
+
+// Obtain the list of queries waiting for changes to a CSV
+WaitList&
+SQLAir::getWaitList(const CSV& csv) {
+    Guard g(waitListsMutex);
+    auto& waitList = waitLists[&csv];
+    if (!waitList) {
+        waitList = std::make_unique<WaitList>(timerWheel);
+    }
+    return *waitList;
+}
+
+// Handle create statements, which are not known to the base class
+bool
+SQLAir::process(const std::string& sql, std::ostream& os) {
+    const StrVec tokens = std::get<0>(preprocess(sql));
+    if (!tokens.empty() && tokens[0] == "create") {
+        validateAndProcessCreate(tokens, os);
+        return true;
+    }
+    return SQLAirBase::process(sql, os);
+}
+
+// Obtain a materialized view with a given name, if any
+std::shared_ptr<MaterializedView>
+SQLAir::getView(const std::string& name) {
+    Guard g(viewsMutex);
+    const auto entry = views.find(name);
+    return (entry == views.end() ? nullptr : entry->second);
+}
+
+// Create a materialized view and add the existing rows to it
+void
+SQLAir::validateAndProcessCreate(const StrVec& sql, std::ostream& os) {
+    if (sql.size() < 6 || sql[1] != "materialized" || sql[2] != "view" ||
+        sql[4] != "as" || sql[5] != "select") {
+        throw Exp("Invalid create query. Expected create materialized view "
+            "name as select ...");
+    }
+    const std::string& name = sql[3];
+    const StrVec select(sql.begin() + 5, sql.end());
+    const int fromIdx = Helper::find(select, "from");
+    if (fromIdx != -1 && fromIdx + 2 < int(select.size()) &&
+        select[fromIdx + 2] == "join") {
+        throw Exp("Joins are not supported in materialized views");
+    }
+    CSV& csv = loadAndGet(Helper::getCSVInfo(select));
+    QueryPlan plan = compileSelect(csv, select);
+    if (!plan.order.empty() || plan.limit != -1 || plan.offset != 0) {
+        throw Exp("Order by and limit are not supported in materialized "
+            "views");
+    }
+    const auto view = std::make_shared<MaterializedView>(std::move(plan));
+    {
+        // The view is registered before it is built so that it receives
+        // the changes made by updates running concurrently with build().
+        // Registering waits for the updates that took a snapshot of the
+        // views without this view, as build() may otherwise pass rows
+        // before they are changed.
+        std::unique_lock<std::shared_mutex> noUpdates(viewsUpdateMutex);
+        Guard g(viewsMutex);
+        if (!views.emplace(name, view).second) {
+            throw Exp("Materialized view " + name + " already exists");
+        }
+        csvViews[&csv].push_back(view);
+    }
+    view->build(csv);
+    os << "Materialized view " << name << " created." << std::endl;
+}
+
+// Serve a select statement from the result cache, if possible
+void
+SQLAir::validateAndProcessSelect(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    // Views are already up to date and are just printed
+    if (const auto view = getView(Helper::getCSVInfo(sql))) {
+        if (sql.size() != 4 || sql[1] != "*" || mustWait) {
+            throw Exp("Only select * is supported on materialized views");
+        }
+        view->print(os);
+        return;
+    }
+    if (mustWait) {
+        // The outcome of waiting queries depends on future updates
+        processSelect(sql, mustWait, os);
+        return;
+    }
+    // The key uses the versions of the CSVs before the query is run. So a
+    // concurrent update makes the cached result unreachable right away.
+    std::vector<CSV*> csvs = {&loadAndGet(Helper::getCSVInfo(sql))};
+    const int fromIdx = Helper::find(sql, "from");
+    if (fromIdx != -1 && fromIdx + 2 < int(sql.size()) &&
+        sql[fromIdx + 2] == "join") {
+        csvs.push_back(&loadAndGet(Helper::getCSVInfo(sql, "join")));
+    }
+    // Results in different formats are cached separately
+    const auto format = ResultWriter::getFormat(os);
+    const std::string key = resultCache.makeKey(sql, csvs) +
+        std::to_string(static_cast<int>(format));
+    if (const auto result = resultCache.lookup(key)) {
+        os << *result;
+        return;
+    }
+    // Stream the result to the client while recording it for the cache
+    ResultRecorder recorder(os, resultCache.maxResultSize());
+    std::ostream recOs(&recorder);
+    ResultWriter::setFormat(recOs, format);
+    processSelect(sql, mustWait, recOs);
+    if (recorder.recorded()) {
+        resultCache.insert(key, recorder.take());
+    }
+}
+
+// Validate a select statement, including where clauses that combine
+// conditions with and/or/not, and process it.
+void
+SQLAir::processSelect(const StrVec& query, bool mustWait,
+        std::ostream& os) {
+    // Wait queries may end with a timeout clause
+    StrVec sql = query;
+    const int timeout = getTimeout(sql, mustWait);
+    // Queries of the form "select ... from a.csv join b.csv ..."
+    const int fromIdx = Helper::find(sql, "from");
+    if (fromIdx != -1 && fromIdx + 2 < int(sql.size()) &&
+        sql[fromIdx + 2] == "join") {
+        validateAndProcessJoin(sql, mustWait, os);
+        return;
+    }
+    // Get the CSV specified in the query, or the most recently used one
+    CSV& csv = loadAndGet(Helper::getCSVInfo(sql));
+    QueryPlan plan = compileSelect(csv, sql);
+    plan.timeout  = timeout;
+    plan.encoding = ResultWriter::getEncoding(ResultWriter::getFormat(os));
+    runSelect(csv, mustWait, plan, os);
+}
+
+// Stream the changes to the rows selected by a query as server-sent events
+void
+SQLAir::subscribe(const StrVec& sql, uint64_t since, const bool resume,
+        std::ostream& os) {
+    const int fromIdx = Helper::find(sql, "from");
+    if (sql.empty() || sql[0] != "select" || (fromIdx != -1 &&
+        fromIdx + 2 < int(sql.size()) && sql[fromIdx + 2] == "join")) {
+        throw Exp("Only select queries on a single CSV can be subscribed to");
+    }
+    CSV& csv = loadAndGet(Helper::getCSVInfo(sql));
+    QueryPlan plan = compileSelect(csv, sql);
+    if (!plan.aggs.empty() || !plan.order.empty() || plan.limit != -1 ||
+        plan.offset != 0) {
+        throw Exp("Aggregates, order by, and limit are not supported in "
+            "subscriptions");
+    }
+    WaitList& waitList = getWaitList(csv);
+    if (!resume) {
+        since = waitList.getVersion();
+    }
+    const auto subs = std::make_shared<Subscription>(waitList,
+        std::move(plan));
+    if (!getAsyncOutput(os)) {
+        subs->slot.emplace(*this);  // The subscription holds this thread
+    }
+    std::string events = "event: columns\ndata: ";
+    for (size_t i = 0; i < subs->plan.colNames.size(); i++) {
+        events += (i > 0 ? "\t" : "") + subs->plan.colNames[i];
+    }
+    events += "\n\n";
+    // Changes made from now on are queued for the subscriber. The rows
+    // changed before that (since the version to resume from) are sent
+    // with their current values. Only the last of these events has an
+    // id, so that a client that disconnects in between resumes from the
+    // same version again.
+    std::vector<int> changed;
+    if (!waitList.addSubscriber(subs->sub, since, changed)) {
+        events += "id: " + std::to_string(since) + "\nevent: reset\n"
+            "data:\n\n";
+    }
+    subs->since = since;
+    std::string rowText, lastRow;
+    for (const int r : changed) {
+        rowText.clear();
+        {
+            Guard g(csv[r].rowMutex);
+            if (!subs->plan.matches(csv[r])) {
+                continue;
+            }
+            subs->plan.appendRow(csv[r], rowText);
+        }
+        events += lastRow;
+        lastRow = "event: update\ndata: " + std::to_string(r) + '\t' +
+            rowText + '\n';
+    }
+    if (!lastRow.empty()) {
+        events += "id: " + std::to_string(since) + '\n' + lastRow;
+    }
+    os << events << std::flush;
+    subs->output = getAsyncOutput(os);
+    if (subs->output) {
+        // Sleep without holding this thread between the changes
+        suspendSubscription(subs);
+        return;
+    }
+    // Stream the queued changes, then sleep until an update changes a
+    // matching row. The wait returns at once if the CSV changed after
+    // the changes were obtained.
+    std::vector<int> unused;
+    while (sendChanges(*subs, os)) {
+        uint64_t version = subs->since;
+        const auto deadline = WaitList::Clock::now() +
+            std::chrono::milliseconds(HeartbeatMs);
+        if (waitList.wait(subs->plan, version, unused, deadline) ==
+            WaitList::Outcome::TIMEOUT) {
+            os << ": keep-alive\n\n" << std::flush;
+        }
+    }
+}
+
+bool
+SQLAir::sendChanges(Subscription& subs, std::ostream& os) {
+    std::vector<WaitList::Change> changes;
+    std::string events;
+    if (!subs.waitList.getChanges(subs.sub, subs.since, changes)) {
+        events = "id: " + std::to_string(subs.since) + "\nevent: reset\n"
+            "data:\n\n";
+    }
+    for (const auto& change : changes) {
+        events += "id: " + std::to_string(change.version) +
+            "\nevent: update\ndata: " + std::to_string(change.row) +
+            '\t' + change.rowText + '\n';
+    }
+    os << events << std::flush;
+    return bool(os);
+}
+
+void
+SQLAir::suspendSubscription(const std::shared_ptr<Subscription>& subs) {
+    // Send the changes (or a keep-alive comment) on a compute thread and
+    // then wait again, until the subscriber disconnects.
+    const auto deadline = WaitList::Clock::now() +
+        std::chrono::milliseconds(HeartbeatMs);
+    subs->waitList.waitAsync(subs->plan, subs->since, deadline,
+        [this, subs](const WaitList::Outcome outcome, const uint64_t,
+            const std::vector<int>&) {
+            subs->output->response->resume([this, subs, outcome] {
+                std::ostream& os = subs->output->os;
+                if (outcome == WaitList::Outcome::TIMEOUT) {
+                    os << ": keep-alive\n\n" << std::flush;
+                }
+                if (sendChanges(*subs, os)) {
+                    suspendSubscription(subs);
+                }
+            });
+        });
+}
+
+// Validate a select statement on a single CSV and compile it into a plan
+QueryPlan
+SQLAir::compileSelect(const CSV& csv, const StrVec& sql) {
+    // The column names are the tokens until a "from" or "where"
+    size_t idx = 1;
+    StrVec colNames;
+    // The aggregate for each entry in colNames. Plain columns are added
+    // as VALUE entries which are resolved once the group by is known.
+    std::vector<AggSpec> aggs;
+    bool hasAggs = false;
+    for (; idx < sql.size() && sql[idx] != "from" && sql[idx] != "where";
+         idx++) {
+        AggSpec::Func func;
+        if (idx + 1 < sql.size() && sql[idx + 1] == "(" &&
+            AggSpec::toFunc(sql[idx], func)) {
+            aggs.push_back(getAggregate(csv, sql, idx, func));
+            colNames.push_back(sql[idx - 3] + "(" + sql[idx - 1] + ")");
+            hasAggs = true;
+        } else {
+            aggs.push_back(AggSpec(AggSpec::Func::VALUE, -1));
+            colNames.push_back(sql[idx]);
+        }
+    }
+    if (colNames.empty()) {
+        throw Exp("Specify column names or just * to select");
+    }
+    // Skip over the CSV (already handled above) in the from clause.
+    if (idx < sql.size() && sql[idx] == "from") {
+        idx += 2;
+    }
+    WhereExpr where;
+    if (idx < sql.size() && sql[idx] == "where") {
+        where = WhereExpr::parse(csv, sql, ++idx, {"group", "order",
+            "limit"});
+    }
+    std::vector<int> groupCols;
+    if (idx < sql.size() && sql[idx] == "group") {
+        groupCols = getGroupCols(csv, sql, ++idx);
+    }
+    if (!hasAggs && groupCols.empty()) {
+        // A regular select query without any aggregates
+        checkColNames(csv, colNames);
+        aggs.clear();
+    }
+    // Each plain column with aggregates must be in the group by clause
+    for (size_t i = 0; i < aggs.size(); i++) {
+        if (aggs[i].func == AggSpec::Func::VALUE) {
+            const int colIdx = csv.getColumnIndex(colNames[i]);
+            aggs[i].colIdx = std::find(groupCols.begin(), groupCols.end(),
+                colIdx) - groupCols.begin();
+            if (colIdx == -1 || aggs[i].colIdx == int(groupCols.size())) {
+                throw Exp("Column " + colNames[i] + " must be in the group "
+                    "by clause");
+            }
+        }
+    }
+    QueryPlan plan(csv, std::move(colNames), std::move(where));
+    plan.aggs      = std::move(aggs);
+    plan.groupCols = std::move(groupCols);
+    // Process the optional "order by col [asc|desc]" clause
+    if (idx < sql.size() && sql[idx] == "order") {
+        plan.order = getOrder(csv, sql, ++idx);
+        if (!plan.groupCols.empty() && std::find(plan.groupCols.begin(),
+                plan.groupCols.end(), plan.order.colIdx) ==
+            plan.groupCols.end()) {
+            throw Exp("Order by column must be in the group by clause");
+        }
+    }
+    // Process the optional "limit N [offset M]" clause
+    if (idx < sql.size() && sql[idx] == "limit") {
+        plan.limit = getRowCount(sql, ++idx, "limit");
+        if (idx < sql.size() && sql[idx] == "offset") {
+            plan.offset = getRowCount(sql, ++idx, "offset");
+        }
+    }
+    if (idx < sql.size()) {
+        throw Exp("Invalid clause " + sql[idx] + " in select query");
+    }
+    return plan;
+}
+
+// Obtain the name used to qualify the columns of a CSV in a join query,
+// i.e., the name of the file without any directory or extension
+static std::string tableAlias(const std::string& fileOrURL) {
+    const size_t start = fileOrURL.rfind('/') + 1;  // npos + 1 is 0
+    return fileOrURL.substr(start, fileOrURL.find('.', start) - start);
+}
+
+// Resolve a (possibly qualified) column name in a join query to the CSV
+// (0 or 1) that has the column and the unqualified name of the column
+static std::pair<int, std::string> resolveJoinCol(CSV* csvs[2],
+        const std::string aliases[2], const std::string& name) {
+    const size_t dot = name.find('.');
+    if (dot != std::string::npos) {
+        const std::string col = name.substr(dot + 1);
+        for (int side = 0; side < 2; side++) {
+            if (name.compare(0, dot, aliases[side]) == 0 &&
+                csvs[side]->getColumnIndex(col) != -1) {
+                return {side, col};
+            }
+        }
+    }
+    const bool inLeft  = (csvs[0]->getColumnIndex(name) != -1);
+    const bool inRight = (csvs[1]->getColumnIndex(name) != -1);
+    if (inLeft && inRight) {
+        throw Exp("Ambiguous column " + name + " in join query");
+    }
+    if (!inLeft && !inRight) {
+        throw Exp("Invalid column " + name + " in join query");
+    }
+    return {(inLeft ? 0 : 1), name};
+}
+
+// Validate a select statement that joins two CSVs and process it.
+void
+SQLAir::validateAndProcessJoin(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    if (mustWait) {
+        throw Exp("wait is not supported for join queries");
+    }
+    const std::string files[2] = {Helper::getCSVInfo(sql),
+        Helper::getCSVInfo(sql, "join")};
+    CSV* csvs[2] = {&loadAndGet(files[0]), &loadAndGet(files[1])};
+    const std::string aliases[2] = {tableAlias(files[0]),
+        tableAlias(files[1])};
+    // Resolve the columns in the select list to one of the two CSVs
+    StrVec colNames, sideCols[2];
+    std::vector<JoinPlan::OutCol> outCols;
+    size_t idx = 1;
+    for (; idx < sql.size() && sql[idx] != "from"; idx++) {
+        std::vector<std::pair<int, std::string>> cols;
+        if (sql[idx] == "*") {
+            for (int side = 0; side < 2; side++) {
+                for (const auto& col : csvs[side]->getColumnNames()) {
+                    cols.push_back({side, col});
+                }
+            }
+        } else {
+            cols.push_back(resolveJoinCol(csvs, aliases, sql[idx]));
+        }
+        for (const auto& [side, col] : cols) {
+            colNames.push_back(sql[idx] == "*" ? col : sql[idx]);
+            outCols.push_back({side, int(sideCols[side].size())});
+            sideCols[side].push_back(col);
+        }
+    }
+    if (colNames.empty()) {
+        throw Exp("Specify column names or just * to select");
+    }
+    // The join condition "on col1 = col2" after "from a.csv join b.csv"
+    idx += 4;
+    if (idx + 3 >= sql.size() || sql[idx] != "on" || sql[idx + 2] != "=") {
+        throw Exp("Invalid join condition in select query");
+    }
+    const auto key1 = resolveJoinCol(csvs, aliases, sql[idx + 1]);
+    const auto key2 = resolveJoinCol(csvs, aliases, sql[idx + 3]);
+    if (key1.first == key2.first) {
+        throw Exp("Join condition must compare columns of the two tables");
+    }
+    idx += 4;
+    // The where clause can only use the columns of one CSV. Qualified
+    // column names are replaced by their unqualified names for parsing.
+    WhereExpr where;
+    int whereSide = -1;
+    if (idx < sql.size() && sql[idx] == "where") {
+        StrVec whereToks;
+        for (idx++; idx < sql.size() && sql[idx] != "limit"; idx++) {
+            const size_t dot = sql[idx].find('.');
+            const int side = (dot == std::string::npos ? -1 :
+                Helper::find({aliases[0], aliases[1]}, sql[idx].substr(0, dot)));
+            if (side != -1 && csvs[side]->getColumnIndex(
+                    sql[idx].substr(dot + 1)) != -1) {
+                if (whereSide != -1 && whereSide != side) {
+                    throw Exp("The where clause in a join query can only use "
+                        "columns of one table");
+                }
+                whereSide = side;
+                whereToks.push_back(sql[idx].substr(dot + 1));
+            } else {
+                whereToks.push_back(sql[idx]);
+            }
+        }
+        size_t whereIdx = 0;
+        if (whereSide != -1) {
+            where = WhereExpr::parse(*csvs[whereSide], whereToks, whereIdx);
+        } else {
+            // Unqualified columns are resolved against the left CSV first
+            try {
+                where = WhereExpr::parse(*csvs[0], whereToks, whereIdx);
+                whereSide = 0;
+            } catch (const Exp&) {
+                whereIdx  = 0;
+                where     = WhereExpr::parse(*csvs[1], whereToks, whereIdx);
+                whereSide = 1;
+            }
+        }
+    }
+    JoinPlan plan(QueryPlan(*csvs[0], sideCols[0], (whereSide == 0 ? where :
+        WhereExpr())), QueryPlan(*csvs[1], sideCols[1], (whereSide == 1 ?
+        where : WhereExpr())));
+    plan.colNames = std::move(colNames);
+    plan.outCols  = std::move(outCols);
+    plan.keyCol[key1.first] = csvs[key1.first]->getColumnIndex(key1.second);
+    plan.keyCol[key2.first] = csvs[key2.first]->getColumnIndex(key2.second);
+    // Process the optional "limit N [offset M]" clause
+    if (idx < sql.size() && sql[idx] == "limit") {
+        plan.limit = getRowCount(sql, ++idx, "limit");
+        if (idx < sql.size() && sql[idx] == "offset") {
+            plan.offset = getRowCount(sql, ++idx, "offset");
+        }
+    }
+    if (idx < sql.size()) {
+        throw Exp("Invalid clause " + sql[idx] + " in select query");
+    }
+    plan.encoding = ResultWriter::getEncoding(ResultWriter::getFormat(os));
+    runJoin(*csvs[0], *csvs[1], plan, os);
+}
+
+// Validate an update statement, including where clauses that combine
+// conditions with and/or/not, and process it.
+void
+SQLAir::validateAndProcessUpdate(const StrVec& query, bool mustWait,
+        std::ostream& os) {
+    // Wait queries may end with a timeout clause
+    StrVec sql = query;
+    const int timeout = getTimeout(sql, mustWait);
+    // Get the CSV specified in the query, or the most recently used one
+    CSV& csv = loadAndGet(Helper::getCSVInfo(sql, "update"));
+    // Extract the "col = value" pairs in the set clause
+    const int setIdx = Helper::find(sql, "set");
+    if (setIdx == -1) {
+        throw Exp("invalid set clause in update query");
+    }
+    size_t idx = setIdx + 1;
+    StrVec colNames, values;
+    for (; idx < sql.size() && sql[idx] != "where"; idx += 3) {
+        if (idx + 2 >= sql.size() || sql[idx + 1] != "=") {
+            throw Exp("invalid set clause in update query");
+        }
+        colNames.push_back(sql[idx]);
+        values.push_back(sql[idx + 2]);
+    }
+    checkColNames(csv, colNames, false, false);
+    WhereExpr where;
+    if (idx < sql.size()) {
+        where = WhereExpr::parse(csv, sql, ++idx);
+    }
+    QueryPlan plan(csv, std::move(colNames), std::move(where),
+        std::move(values));
+    plan.timeout = timeout;
+    runUpdate(csv, mustWait, plan, os);
+}
+
 void 
 SQLAir::insertQuery(CSV& csv, bool mustWait, StrVec colNames, 
         StrVec values, std::ostream& os) {
@@ -160,23 +1600,86 @@ void SQLAir::clientThread(std::istream& is, std::ostream& os) {
     std::string line, path;
     is >> line >> path;
     // Skip/ignore all the HTTP request & headers for now.
-    if (path.find("/sql-air?query=") != std::string::npos) {
+    if (path.find("/sql-air/subscribe?query=") == 0) {
+        // A subscription to the changes selected by a query. It resumes
+        // after the version in the "since" parameter or the standard
+        // Last-Event-ID header sent by reconnecting EventSource clients.
+        std::string since;
+        for (std::string hdr; std::getline(is, hdr) && !hdr.empty()
+            && hdr != "\r"; ) {
+            if (strncasecmp(hdr.c_str(), "last-event-id:", 14) == 0) {
+                since = Helper::trim(hdr.substr(14));
+            }
+        }
+        path = path.substr(25);
+        const size_t paramPos = path.find("&since=");
+        if (paramPos != std::string::npos) {
+            since = Helper::url_decode(path.substr(paramPos + 7));
+            path.erase(paramPos);
+        }
+        os << HTTPRespHeader << "text/event-stream\r\n"
+           << "Transfer-Encoding: chunked\r\n\r\n";
+        // The output is kept by a subscription that sleeps without
+        // holding this thread, until the subscriber disconnects.
+        auto* const client = dynamic_cast<tcp::iostream*>(&os);
+        currentOutput = std::make_shared<RequestOutput>(os, client ?
+            client->socket().native_handle() : -1,
+            AsyncServer::getResponse());
+        std::ostream& chunkOs = currentOutput->os;
+        try {
+            if (!since.empty() && (since.size() > 19 ||
+                since.find_first_not_of("0123456789") != std::string::npos)) {
+                throw Exp("Invalid event id " + since);
+            }
+            const StrVec sql = std::get<0>(preprocess(
+                Helper::url_decode(path)));
+            subscribe(sql, since.empty() ? 0 : std::stoull(since),
+                !since.empty(), chunkOs);
+        } catch (const std::exception &exp) {
+            chunkOs << "event: error\ndata: " << exp.what() << "\n\n";
+        }
+        currentOutput.reset();
+    } else if (path.find("/sql-air?query=") != std::string::npos) {
         // This is a command to be processed. So use a helper method
         // to streamline the code.
         for (std::string hdr; std::getline(is, hdr) && !hdr.empty()
             && hdr != "\r"; ) {}
-        std::ostringstream oss;
         path = path.substr(15);  // get rid of the syntax at the begin ?
+        // The query can be followed by an "&format=..." parameter
+        ResultWriter::Format format = ResultWriter::Format::TEXT;
+        std::string formatErr;
+        const size_t paramPos = path.find("&format=");
+        if (paramPos != std::string::npos) {
+            try {
+                format = ResultWriter::toFormat(Helper::url_decode(
+                    path.substr(paramPos + 8)));
+            } catch (const std::exception &exp) {
+                formatErr = exp.what();
+            }
+            path.erase(paramPos);
+        }
         path = Helper::url_decode(path);
+        // Stream the results to the client in chunks as they are produced,
+        // unless they fit in one chunk and are sent with a Content-Length.
+        // Chunks are written directly to the socket, if there is one. The
+        // output is kept by a wait query that sleeps without holding this
+        // thread, which writes the last chunk once it is done.
+        auto* const client = dynamic_cast<tcp::iostream*>(&os);
+        currentOutput = std::make_shared<RequestOutput>(os, client ?
+            client->socket().native_handle() : -1,
+            AsyncServer::getResponse(), HTTPRespHeader +
+            ResultWriter::contentType(format) + "\r\n");
+        std::ostream& chunkOs = currentOutput->os;
+        ResultWriter::setFormat(chunkOs, format);
         try {
-            SQLAirBase::process(path, oss);
+            if (!formatErr.empty()) {
+                throw Exp(formatErr);
+            }
+            process(path, chunkOs);
         }  catch (const std::exception &exp) {
-            oss  << "Error: " << exp.what() << std::endl;
+            ResultWriter::writeError(chunkOs, exp.what());
         }
-        std::string html = oss.str();
-        auto httpRespHdr = boost::str(boost::format(HTTPRespHeader) 
-                    % html.length());
-        os << httpRespHdr << html;   
+        currentOutput.reset();
     } else if (!path.empty()) {
         // In this case we assume the user is asking for a file. Have
         // the helper http class do the processing.
@@ -187,20 +1690,30 @@ void SQLAir::clientThread(std::istream& is, std::ostream& os) {
         path = Helper::url_decode(path);
         os << http::file(path);
     }
-    // decrease thread count
-    SQLAir::numThreads--;
-    SQLAir::thrCond.notify_one();  // end client thread by notify empty slot
 }
 
 // The method to have this class run as a web-server. 
 void 
 SQLAir::runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr) {
-    // unique lock for the server 
-    std::unique_lock<std::mutex> lock(SQLAir::serverMutex);
+    const int numWorkers = std::max(1, maxThr);
+    const int ioThreads  = getIoThreads();
+    if (ioThreads > 0) {
+        // Accept connections and read requests asynchronously on a few
+        // I/O threads. Only requests being processed use a worker.
+        ThreadPool computePool(numWorkers, 0, IdleWorkers);
+        AsyncServer(server, computePool, [this](std::istream& is,
+            std::ostream& os) { clientThread(is, os); }).run(ioThreads);
+        return;
+    }
+    // The workers that process connections. Connections that arrive while
+    // all the workers are busy wait in the queue. When the queue is full,
+    // submit() blocks, which stops accepting connections until a worker
+    // frees up. The threads are started once rather than per connection.
+    // Some workers are left for requests other than sleeping wait queries
+    // and subscriptions, if there are more than one.
+    maxLongLived = std::max(1, numWorkers - std::max(1, numWorkers / 4));
+    ThreadPool clientPool(numWorkers, numWorkers, IdleWorkers);
     while (true) {
-        // we have 2 threads when starting the .exe
-        SQLAir::thrCond.wait(lock, [&] 
-                                 {return SQLAir::numThreads <= maxThr; });
         // Setup a server socket to accept connections on the socket
         // Create garbage-collected, shared object on heap so we can
         // send it to another thread and not worry about life-time of
@@ -208,12 +1721,9 @@ SQLAir::runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr) {
         TcpStreamPtr client = std::make_shared<tcp::iostream>();
         // Wait for a client to connect
         server.accept(*client->rdbuf());
-        // Process request from client on a separate background thread
-        std::thread thr([this, client]()
+        // Process request from client on one of the workers
+        clientPool.submit([this, client]()
             { SQLAir::clientThread(*client, *client);});
-        thr.detach();  
-        // increase thread count
-        SQLAir::numThreads++;
     }
 }
 
@@ -11,14 +11,25 @@
 
 #include <boost/asio.hpp>
 #include <string>
+#include <climits>
 #include <unordered_map>
 #include <iostream>
 #include <tuple>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <shared_mutex>
 #include <condition_variable>
 #include "SQLAirBase.h"
+#include "QueryPlan.h"
+#include "ThreadPool.h"
+#include "Join.h"
+#include "ResultCache.h"
+#include "MaterializedView.h"
+#include "ChunkedStream.h"
+#include "ResultWriter.h"
+#include "WaitList.h"
+#include "AsyncServer.h"
 
 // Shortcut to smart pointer with TcpStream
 using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
@@ -30,16 +41,153 @@ using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
  */
 class SQLAir : public SQLAirBase {
 public:
-    // Helper method to process each row in select queries
-    void selectRowProcess(CSV& csv, StrVec colNames, 
-        const int whereColIdx, const std::string& cond, 
-        const std::string& value, 
+    /**
+     * The number of rows in each morsel, i.e., the unit of work handed to
+     * a thread when a single query is processed by multiple threads.
+     */
+    static constexpr int MorselSize = 16 * 1024;
+
+    /**
+     * The number of morsels per thread processed before their rows are
+     * written, when the rows of a select query are streamed to a client.
+     * It bounds the memory used to buffer the rows of a large result.
+     */
+    static constexpr int StreamWindow = 4;
+
+    /**
+     * The number of milliseconds after which an idle subscription sends a
+     * keep-alive comment. It also bounds the time taken to notice that a
+     * subscriber has disconnected.
+     */
+    static constexpr int HeartbeatMs = 15000;
+
+    /**
+     * The number of idle workers the server keeps for later requests.
+     * The workers started for a burst of requests beyond this number exit
+     * once the burst is over.
+     */
+    static constexpr int IdleWorkers = 2;
+
+    /**
+     * Create the SQLAir object along with the pool of threads used to
+     * process a single query in parallel.
+     *
+     * @param scanThreads The maximum number of threads (including the 
+     * client's thread) used to process a single query. If this value is
+     * zero, then the value of the SQLAIR_SCAN_THREADS environment variable
+     * is used, if set. Otherwise, the number of cores is used.
+     *
+     * The default deadline of wait queries (in milliseconds) is obtained
+     * from the SQLAIR_WAIT_TIMEOUT_MS environment variable, if set.
+     * Otherwise, wait queries without a timeout clause wait indefinitely.
+     */
+    explicit SQLAir(const int scanThreads = 0);
+
+    /**
+     * Top-level method to process a SQL-air query. This method overrides
+     * the base class version to handle queries that create materialized
+     * views (see validateAndProcessCreate()). All other queries are
+     * processed by the base class.
+     *
+     * @param sql The SQL-air query to be processed by this method.
+     *
+     * @param os The output stream to where results from the processing are
+     * to be written.
+     *
+     * @return This method returns true if further queries are to be processed.
+     */
+    bool process(const std::string& sql, std::ostream& os) override;
+
+    // Helper method to process each row in select queries. The selected
+    // rows are written to out (nothing is written if no rows are
+    // selected).
+    void selectRowProcess(CSV& csv, const QueryPlan& plan,
+        ResultWriter& out);
+
+    // Helper method to process only the given rows (in ascending order) in
+    // select queries whose result was empty before the rows were changed.
+    // Queries where other rows can affect the result are processed via
+    // selectRowProcess() if any of the given rows match.
+    void selectChangedProcess(CSV& csv, const QueryPlan& plan,
+        const std::vector<int>& rows, ResultWriter& out);
+
+    // Helper method to process each row in select queries that have no
+    // aggregates or order by clause. The rows are written to out in
+    // batches as they are found, so the whole result is never buffered.
+    void streamRowProcess(CSV& csv, const QueryPlan& plan,
+        ResultWriter& out);
+
+    // Helper method to process the rows in [start, end) in select queries.
+    // The first skip matching rows are not printed (skip is decremented
+    // for each of them) and processing stops once maxRows rows have been
+    // printed. Returns the number of rows printed.
+    int selectRangeProcess(CSV& csv, const QueryPlan& plan, const int start,
+        const int end, std::string& rowText, int& skip,
+        const int maxRows);
+
+    // Helper method to process each row in select queries that have an
+    // order by clause
+    void orderedRowProcess(CSV& csv, const QueryPlan& plan,
         std::string& rowText, int& rowCount);
 
-    // Helper method to process each row in update queries
-    void updateRowProcess(CSV& csv, StrVec colNames, StrVec values,
-        const int whereColIdx, const std::string& cond, 
-        const std::string& value, int& rowCount);
+    // Helper method to collect the rows in [start, end) that are selected
+    // by a query with an order by clause
+    void orderedRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, OrderedRows& rows);
+
+    // Helper method to process each row in select queries that only
+    // have aggregates in the select list
+    void aggregateRowProcess(CSV& csv, const QueryPlan& plan,
+        std::string& rowText, int& rowCount);
+
+    // Helper method to compute partial aggregates for the rows in
+    // [start, end) that are selected by a query
+    void aggregateRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::vector<AggState>& states);
+
+    // Helper method to process each row in select queries with a group
+    // by clause
+    void groupRowProcess(CSV& csv, const QueryPlan& plan,
+        std::string& rowText, int& rowCount);
+
+    // Helper method to add the rows in [start, end) that are selected by
+    // a query to hash tables of groups. The groups are partitioned across
+    // the tables based on the hash of their keys.
+    void groupRangeProcess(CSV& csv, const QueryPlan& plan,
+        const int start, const int end, std::vector<AggTable>& parts);
+
+    // Helper method to build the hash table for a join from the selected
+    // rows on the build side of the join
+    void joinBuildProcess(CSV& csv, const QueryPlan& plan, const int keyCol,
+        JoinTable& table);
+
+    // Helper method to probe the hash table of a join with the rows in
+    // [start, end) on the probe side of the join. The first skip joined
+    // rows are not printed and processing stops once maxRows rows have
+    // been printed. Returns the number of rows printed.
+    int joinRangeProcess(CSV& csv, const JoinPlan& plan, const int probe,
+        const JoinTable& table, const int start, const int end,
+        std::string& rowText, int skip = 0, const int maxRows = INT_MAX);
+
+    // Helper method to process each row in update queries. The indices of
+    // the rows updated are added to changed (in ascending order).
+    void updateRowProcess(CSV& csv, const QueryPlan& plan, int& rowCount,
+        std::vector<int>& changed);
+
+    // Helper method to process only the given rows (e.g., the rows changed
+    // by other updates) in update queries. The indices of the rows updated
+    // are added to changed.
+    void updateChangedProcess(CSV& csv, const QueryPlan& plan,
+        const std::vector<int>& rows, int& rowCount,
+        std::vector<int>& changed);
+
+    // Helper method to process the rows in [start, end) in update queries.
+    // The indices of the rows updated are added to changed. Each change is
+    // also applied to the given materialized views of the CSV. Returns the
+    // number of rows updated.
+    int updateRangeProcess(CSV& csv, const QueryPlan& plan, const int start,
+        const int end, std::vector<int>& changed,
+        const MaterializedViews& views = {});
     /**
      * Method to perform the actual operations associated with printing a
      * given set of columns in a given CSV that match an optional condition.
@@ -242,17 +390,39 @@ public:
     /**
      * Method to have this class run as a web-server that runs forever and 
      * keeps processing requests. This method does not do the core processing.
-     * Instead, for each connection it starts a detached-thread to process the
-     * request from the client. Hence, the task of processing HTTP-GET request
-     * is delegated to the clientThread method. 
-     * 
-     * @note This method uses detached threads to process each request.
+     * Instead, each request is handed to a pool of up to maxThr worker
+     * threads that process the request from the client. Hence, the task of
+     * processing HTTP-GET request is delegated to the clientThread method. 
+     * 
+     * By default, connections are accepted and their requests are read
+     * asynchronously (see AsyncServer) by the calling thread, plus any
+     * extra threads requested via the SQLAIR_IO_THREADS environment
+     * variable. So connections only use a worker while their request is
+     * being processed. If SQLAIR_IO_THREADS is zero, connections are
+     * instead accepted with blocking calls and handed to the workers. In
+     * that case, connections that arrive while all the workers are busy
+     * wait in a bounded queue. Once the queue is full, no more connections
+     * are accepted until a worker frees up.
+     *
+     * Workers (and the helpers of the scan pool) are only started when
+     * there are requests for them. So the server uses at most maxThr
+     * workers, scanThreads - 1 scan helpers, SQLAIR_IO_THREADS - 1 extra
+     * I/O threads and the timer thread, in addition to the calling thread.
+     * With light load, it uses about one thread per request in progress.
+     *
+     * Wait queries that sleep and subscriptions can last a long time. The
+     * asynchronous server releases the worker while they sleep, and
+     * continues them on a worker once they are woken up. So any number of
+     * them may be in progress. With blocking calls, each of them instead
+     * holds a worker. So at most max(1, maxThr - max(1, maxThr / 4)) of
+     * them may be in progress, and further ones are refused with an error.
+     * The other workers are left for requests that complete quickly
+     * (including the updates that the wait queries wait for).
      * 
      * @param server The BOOST acceptor that must be used to accept connections
      * from clients.
      * 
-     * @param maxThr An optional maximum number of threads to be used by this
-     * method.
+     * @param maxThr The number of worker threads that process requests.
      */
     void runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr);
 
@@ -350,9 +520,244 @@ protected:
         StrVec values, const int whereColIdx, const std::string& cond, 
         const std::string& value);
     
+    /**
+     * Method to print the rows selected by a compiled select query. This
+     * method is called from selectQuery() and validateAndProcessSelect()
+     * and implements the output and wait semantics documented in 
+     * selectQuery().
+     * 
+     * @param csv The CSV data to be used.
+     * 
+     * @param mustWait If this flag is true, then this query must keep trying
+     * until at least one row is selected or its deadline passes, in which
+     * case no rows are printed.
+     * 
+     * @param plan The compiled query with the columns to be printed, the
+     * where clause to be checked, and the timeout of a wait query.
+     * 
+     * @param os The output stream to where the results are to be written.
+     */
+    void runSelect(CSV& csv, bool mustWait, const QueryPlan& plan,
+        std::ostream& os);
+
+    /**
+     * Method to update the rows that match a compiled update query. This
+     * method is called from updateQuery() and validateAndProcessUpdate()
+     * and implements the wait semantics documented in updateQuery().
+     * 
+     * @param csv The CSV whose values are to be updated.
+     * 
+     * @param mustWait If this flag is true then this method must repeatedly
+     * try performing the update operation until at least 1 row is updated
+     * or its deadline passes, in which case no rows are updated.
+     * 
+     * @param plan The compiled query with the columns and values to be set,
+     * the where clause to be checked, and the timeout of a wait query.
+     * 
+     * @param os The output stream to where the number of rows updated must
+     * be written -- e.g." "1 row(s) updated.\n"
+     */
+    void runUpdate(CSV& csv, bool mustWait, const QueryPlan& plan,
+        std::ostream& os);
+
+    /**
+     * Checks if a select query is valid and processes it. Results of
+     * queries that do not wait are served from the result cache if none
+     * of the CSVs used by the query have changed since the result was
+     * cached. Otherwise, the query is processed via processSelect().
+     * 
+     * @param sql The tokens in the select statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 matching row is found.
+     * @param os The output stream to where the results are to be written.
+     * 
+     * @exception This method throws an exception if error occur when 
+     * processing the specified SQL
+     */
+    void validateAndProcessSelect(const StrVec& sql, bool mustWait, 
+        std::ostream &os) override;
+
+    /**
+     * Checks if a select query is valid and processes it. This method
+     * supports where clauses that
+     * combine conditions with "and", "or", "not", and parentheses, along
+     * with the additional conditions in WhereExpr (e.g., "<", ">=", "in").
+     * The select list can instead have the aggregates count, sum, avg,
+     * min, and max (e.g., "count(*), avg(rating)"), computed for each
+     * group if there is a "group by col1 [, col2 ...]" clause.
+     * An optional "order by col [asc|desc]" clause sorts the selected
+     * rows (see RowOrder for how values are compared).
+     * An optional "limit N [offset M]" clause at the end of the query
+     * restricts the rows printed. Without an order by clause, the scan
+     * stops as soon as enough rows have been found. Queries that join
+     * two CSVs are handled by validateAndProcessJoin().
+     * 
+     * @param sql The tokens in the select statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 matching row is found.
+     * @param os The output stream to where the results are to be written.
+     * 
+     * @exception This method throws an exception if error occur when 
+     * processing the specified SQL
+     */
+    void processSelect(const StrVec& sql, bool mustWait, std::ostream &os);
+
+    /**
+     * Stream the changes to the rows selected by a query as server-sent
+     * events, until the subscriber disconnects. Only plain select queries
+     * on a single CSV (without aggregates, order by, or limit) can be
+     * subscribed to. The events are:
+     *
+     *   - "columns": sent first, with the selected column names.
+     *   - "update": a row whose new values match the where clause was
+     *     changed. The data is the index of the row followed by the
+     *     selected values. The id is the version of the CSV created by
+     *     the update, which can be used to resume the subscription.
+     *     When a subscription is resumed, the rows changed in between
+     *     are sent with their current values, and only the last of
+     *     these events has an id (the version at which it resumed).
+     *   - "reset": the changes since the version to resume from are no
+     *     longer known. The subscriber must rerun the query. The id is
+     *     the version from which events are then streamed.
+     *
+     * Rows that are changed so that they no longer match the where clause
+     * do not generate events. A reset is also sent if the subscriber
+     * falls more than WaitList::MaxQueued changes behind.
+     *
+     * @param sql The tokens in the select statement to be subscribed to.
+     *
+     * @param since The version of the CSV after which changes are to be
+     * streamed, i.e., the id of the last event received.
+     *
+     * @param resume If this flag is false, since is ignored and only the
+     * changes made after subscribing are streamed.
+     *
+     * @param os The output stream to where the events are to be written.
+     *
+     * @exception This method throws an exception if the query is invalid
+     * or if too many requests already hold a worker (see runServer()).
+     */
+    void subscribe(const StrVec& sql, uint64_t since, const bool resume,
+        std::ostream& os);
+
+    /**
+     * Validates a select query on a single CSV (see processSelect()) and
+     * compiles it into a plan.
+     * 
+     * @param csv The CSV specified in the query.
+     * @param sql The tokens in the select statement to be compiled.
+     * 
+     * @return The compiled query.
+     * 
+     * @exception This method throws an exception if the query is invalid.
+     */
+    QueryPlan compileSelect(const CSV& csv, const StrVec& sql);
+
+    /**
+     * Checks if a query that creates a materialized view is valid and
+     * processes it. The queries are of the form:
+     * 
+     *     create materialized view name as select ... from a.csv ...
+     * 
+     * The select query cannot be a join and cannot have order by or limit
+     * clauses. The contents of the view are read via "select * from name"
+     * and are kept up to date as rows in the CSV are updated.
+     * 
+     * @param sql The tokens in the create statement to be processed.
+     * @param os The output stream to where the results are to be written.
+     * 
+     * @exception This method throws an exception if error occur when 
+     * processing the specified SQL
+     */
+    void validateAndProcessCreate(const StrVec& sql, std::ostream &os);
+
+    /**
+     * Obtain a materialized view with a given name.
+     * 
+     * @param name The name of the view.
+     * 
+     * @return The view, or nullptr if there is no view with the name.
+     */
+    std::shared_ptr<MaterializedView> getView(const std::string& name);
+
+    /**
+     * Obtain the list of queries waiting for the rows of a CSV to change,
+     * creating an empty list the first time.
+     * 
+     * @param csv The CSV being waited on.
+     * 
+     * @return The list of waiters on the CSV.
+     */
+    WaitList& getWaitList(const CSV& csv);
+
+    /**
+     * Obtain a snapshot of the materialized views defined on a CSV.
+     * Update queries must hold viewsUpdateMutex (shared) from the time
+     * they take the snapshot until they are done changing rows.
+     * 
+     * @param csv The CSV on which the views are defined.
+     * 
+     * @return The views on the CSV.
+     */
+    MaterializedViews getViews(const CSV& csv);
+
+    /**
+     * Method to print the rows selected by a compiled join query. The
+     * smaller of the two CSVs is used to build the hash table, which is
+     * then probed by the rows of the other CSV using the scan pool.
+     * 
+     * @param left The CSV before the "join" keyword in the query.
+     * 
+     * @param right The CSV after the "join" keyword in the query.
+     * 
+     * @param plan The compiled join query.
+     * 
+     * @param os The output stream to where the results are to be written.
+     */
+    void runJoin(CSV& left, CSV& right, const JoinPlan& plan,
+        std::ostream& os);
+
+    /**
+     * Checks if a select query that joins two CSVs is valid and processes
+     * it. The queries are of the form:
+     * 
+     *     select cols from a.csv join b.csv on a.x = b.y [where ...]
+     *         [limit N [offset M]]
+     * 
+     * Columns can be qualified with the name of the CSV (without the
+     * extension) and must be qualified if both CSVs have the column. The
+     * where clause can only use the columns of one of the CSVs.
+     * 
+     * @param sql The tokens in the select statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 matching row is found. Waiting is not supported for joins.
+     * @param os The output stream to where the results are to be written.
+     * 
+     * @exception This method throws an exception if error occur when 
+     * processing the specified SQL
+     */
+    void validateAndProcessJoin(const StrVec& sql, bool mustWait,
+        std::ostream &os);
+
+    /**
+     * Checks if an update query is valid and processes it. This method
+     * overrides the base class version to support the same where clauses
+     * as validateAndProcessSelect().
+     * 
+     * @param sql The tokens in the update statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 row is updated.
+     * @param os The output stream to where the results are to be written.
+     * 
+     * @exception This method throws an exception if error occur when 
+     * processing the specified SQL
+     */
+    void validateAndProcessUpdate(const StrVec& sql, bool mustWait, 
+        std::ostream &os) override;
+
     /**
      * A thread-main method to process each request from a web-client in a
-     * separate thread. This method is called from the runServer method
+     * worker thread. This method is called from the runServer method
      * each time a client connects, when sql-air is running as a web-server.
      * This web-server will get the following 2 types of HTTP-GET requests:
      *     1. Request to run a query where the request starts with the prefix
@@ -396,8 +801,126 @@ protected:
         const std::string& port, const std::string& path);
 
 private:
-    // used in server unique lock
-    std::mutex serverMutex;
+    /**
+     * A slot held by a request that holds a worker for a long time, i.e.,
+     * a wait query while it sleeps or a subscription, when connections are
+     * processed with blocking calls. The asynchronous server releases the
+     * worker while they sleep, so they do not take a slot. The slot is
+     * freed when this object is destroyed.
+     */
+    class LongLivedSlot {
+    public:
+        /**
+         * Take a slot.
+         *
+         * @param air The server whose slots are counted.
+         *
+         * @exception Exp This constructor throws an exception if the
+         * maximum number of slots are already taken.
+         */
+        explicit LongLivedSlot(SQLAir& air);
+
+        /** Free the slot */
+        ~LongLivedSlot();
+
+        LongLivedSlot(const LongLivedSlot&) = delete;
+        LongLivedSlot& operator=(const LongLivedSlot&) = delete;
+
+    private:
+        /** The server whose slots are counted */
+        SQLAir& air;
+    };
+
+    /** The chunked output of a request, defined in SQLAir.cpp */
+    struct RequestOutput;
+
+    /** A wait query that sleeps without holding a worker, defined in
+     * SQLAir.cpp
+     */
+    struct SuspendedQuery;
+
+    /** A subscription to the changes to the rows selected by a query,
+     * defined in SQLAir.cpp
+     */
+    struct Subscription;
+
+    /**
+     * Obtain the output of the request being processed by the calling
+     * thread, if a wait query that writes to a given stream can sleep
+     * without holding the thread, i.e., in the asynchronous server.
+     *
+     * @param os The stream to where the query writes its results.
+     *
+     * @return The output of the request, or nullptr if the query has to
+     * block the calling thread while it sleeps.
+     */
+    static std::shared_ptr<RequestOutput> getAsyncOutput(
+        const std::ostream& os);
+
+    /**
+     * Wait for an update that may let a wait query proceed, without
+     * blocking the calling thread. Once woken up (or its deadline passes),
+     * the query is continued by resumeQuery() on a compute thread.
+     *
+     * @param query The wait query that sleeps.
+     */
+    void suspendQuery(const std::shared_ptr<SuspendedQuery>& query);
+
+    /**
+     * Recheck the rows for a wait query that was woken up and write its
+     * results once it is done. Otherwise, the query is suspended again.
+     *
+     * @param query The wait query that was woken up.
+     *
+     * @param outcome The outcome of the wait.
+     *
+     * @param version The version of the CSV at the end of the wait.
+     *
+     * @param changed The rows changed during the wait, if known.
+     */
+    void resumeQuery(const std::shared_ptr<SuspendedQuery>& query,
+        const WaitList::Outcome outcome, const uint64_t version,
+        const std::vector<int>& changed);
+
+    /**
+     * Write the events for the changes queued for a subscription.
+     *
+     * @param subs The subscription.
+     *
+     * @param os The output stream to where the events are to be written.
+     *
+     * @return False if the subscriber has disconnected.
+     */
+    bool sendChanges(Subscription& subs, std::ostream& os);
+
+    /**
+     * Wait for a matching update (or the next heartbeat) of a subscription
+     * without blocking the calling thread. The subscription then sends the
+     * changes on a compute thread and waits again, until the subscriber
+     * disconnects.
+     *
+     * @param subs The subscription.
+     */
+    void suspendSubscription(const std::shared_ptr<Subscription>& subs);
+
+    /**
+     * Finish an update query by notifying the queries waiting on the rows
+     * it changed and writing the number of rows updated.
+     *
+     * @param csv The CSV that was updated.
+     *
+     * @param rowCount The number of rows updated.
+     *
+     * @param changed The indices of the rows changed.
+     *
+     * @param os The output stream to where the number of rows updated is
+     * to be written.
+     */
+    void finishUpdate(CSV& csv, const int rowCount,
+        const std::vector<int>& changed, std::ostream& os);
+
+    /** The output of the request being processed by the calling thread */
+    static thread_local std::shared_ptr<RequestOutput> currentOutput;
 
     /**
      * The most recently referenced CSV in a query. This value is updated
@@ -421,18 +944,80 @@ private:
      */
     std::unordered_map<std::string, CSV> inMemoryCSV;
     
-    // -------------[ Limit number of threads ]-------------------    
-    /** The atomic counter that tracks the number of active threads.
-     * This counter is incremented in runServer each time a thread is started.
-     * It is decremented at the end of clientThread each time a thread finishes.
+    // -------------[ Intra-query parallelism ]-------------------
+    /** The maximum number of threads (including the client's thread)
+     * used to process a single query. This value is set in the
+     * constructor and is never changed.
+     */
+    const int scanThreads;
+
+    /** The pool of worker threads shared by all queries to process
+     * morsels of a CSV in parallel.
+     */
+    ThreadPool scanPool;
+    // -----------------------------------------------------------
+
+    // -------------[ Result caching ]----------------------------
+    /** The cache of the results of select queries. It also tracks the
+     * version of each CSV, which is bumped by runUpdate.
+     */
+    ResultCache resultCache;
+    // -----------------------------------------------------------
+
+    // -------------[ Materialized views ]------------------------
+    /** The mutex to protect the views and csvViews maps below */
+    std::mutex viewsMutex;
+
+    /** The materialized views, keyed by their names */
+    std::unordered_map<std::string, std::shared_ptr<MaterializedView>> views;
+
+    /** The materialized views defined on each CSV. The views are updated
+     * by updateRangeProcess each time a row of the CSV changes.
+     */
+    std::unordered_map<const CSV*, MaterializedViews> csvViews;
+
+    /** Update queries hold this mutex (shared) while they change rows
+     * using a snapshot of the views of a CSV. Creating a view holds it
+     * exclusively while the view is registered. So once a view is built,
+     * every update that did not see the view has finished, and its
+     * changes are included by build().
+     */
+    std::shared_mutex viewsUpdateMutex;
+    // -----------------------------------------------------------
+
+    // -------------[ Wait queries ]------------------------------
+    /** The mutex to protect the waitLists map below */
+    std::mutex waitListsMutex;
+
+    /** The queries waiting for the rows of each CSV to change. The lists
+     * are never removed, so references to them remain valid.
+     */
+    std::unordered_map<const CSV*, std::unique_ptr<WaitList>> waitLists;
+
+    /** The default deadline (in milliseconds) of wait queries without a
+     * timeout clause, or -1 to wait indefinitely. This value is set in
+     * the constructor and is never changed.
+     */
+    const int waitTimeout;
+
+    /** The mutex to protect numLongLived below */
+    std::mutex longLivedMutex;
+
+    /** The number of LongLivedSlot objects currently in existence */
+    int numLongLived = 0;
+
+    /** The maximum number of wait queries (while they sleep) and
+     * subscriptions that may hold a worker at the same time. It is set by
+     * runServer() when connections are processed with blocking calls, so
+     * that some workers are left for other requests.
      */
-    std::atomic<int> numThreads = {0};
+    int maxLongLived = INT_MAX;
 
-    /** A condition variable to wait if number of threads being used 
-     * exceeds a given limit. The runServer method waits on it. The 
-     * clientThread method call notify.
+    /** The timer wheel that enforces the deadlines of all wait queries.
+     * It is declared after waitLists so that its thread is stopped before
+     * the lists used by its callbacks are destroyed.
      */
-    std::condition_variable thrCond;
+    TimerWheel timerWheel;
     // -----------------------------------------------------------
 };
 
@@ -0,0 +1,127 @@
+/* copyright caohd 2023
+ * Implementation of a simple pool of worker threads started on demand.
+ */
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "ThreadPool.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+ThreadPool::ThreadPool(const int numThreads, const size_t maxQueued,
+    const int maxIdle) : maxThreads(numThreads), maxIdle(maxIdle),
+    maxQueued(maxQueued) {
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        Guard g(queueMutex);
+        stop = true;
+    }
+    queueCond.notify_all();
+    // Workers no longer exit once stop is set, so the lists are stable
+    for (auto& thr : workers) {
+        thr.join();
+    }
+    for (auto& thr : exited) {
+        thr.join();
+    }
+}
+
+void
+ThreadPool::joinExited() {
+    // The exited workers released queueMutex when they returned, so
+    // joining them here does not deadlock.
+    for (auto& thr : exited) {
+        thr.join();
+    }
+    exited.clear();
+}
+
+void
+ThreadPool::submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        spaceCond.wait(lock, [this] {
+            return maxQueued == 0 || tasks.size() < maxQueued; });
+        tasks.push(std::move(task));
+        joinExited();
+        // Start another worker if the idle ones cannot take all the tasks.
+        // The worker needs queueMutex to start, so its entry is set first.
+        if (tasks.size() > size_t(idle) && int(workers.size()) < maxThreads) {
+            const auto self = workers.emplace(workers.end());
+            *self = std::thread([this, self] { workerMain(self); });
+        }
+    }
+    queueCond.notify_one();
+}
+
+void
+ThreadPool::workerMain(const std::list<std::thread>::iterator self) {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (tasks.empty() && !stop && idle >= maxIdle) {
+                // Enough workers are idle. So this one exits and is joined
+                // by the next call to submit() or by the destructor.
+                exited.push_back(std::move(*self));
+                workers.erase(self);
+                return;
+            }
+            idle++;
+            queueCond.wait(lock, [this] { return stop || !tasks.empty(); });
+            idle--;
+            if (tasks.empty()) {
+                return;  // The pool is being stopped
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        if (maxQueued != 0) {
+            spaceCond.notify_one();
+        }
+        task();
+    }
+}
+
+void
+ThreadPool::parallelFor(const int count, const int maxThreads,
+        const std::function<void(int)>& func) {
+    // The state shared between the calling thread and the helper tasks.
+    // Helper tasks may start after all the work is done (and this method
+    // has returned), so the state is kept alive by the tasks as well.
+    struct State {
+        std::atomic<int> next = {0};
+        int done = 0;
+        std::mutex doneMutex;
+        std::condition_variable doneCond;
+    };
+    auto state = std::make_shared<State>();
+    // Run indices until there are none left to be claimed. The func is
+    // only used after claiming an index, i.e., while this method waits.
+    auto run = [state, count, &func] {
+        int finished = 0;
+        for (int idx; (idx = state->next++) < count; finished++) {
+            func(idx);
+        }
+        if (finished > 0) {
+            Guard g(state->doneMutex);
+            state->done += finished;
+            if (state->done == count) {
+                state->doneCond.notify_all();
+            }
+        }
+    };
+    // Have some workers help out and also do work on this thread
+    const int helpers = std::min({maxThreads - 1, size(), count - 1});
+    for (int i = 0; i < helpers; i++) {
+        submit(run);
+    }
+    run();
+    // Wait for the indices being processed by the helpers to finish
+    std::unique_lock<std::mutex> lock(state->doneMutex);
+    state->doneCond.wait(lock, [&] { return state->done == count; });
+}
@@ -0,0 +1,141 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * A simple pool of worker threads that run tasks from a
+ * shared queue. The pool is used by SQLAir to split the work of a single
+ * query across multiple cores and to process the connections of clients.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <functional>
+#include <limits>
+#include <queue>
+#include <list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * A pool with a fixed maximum number of worker threads. Workers are
+ * started on demand, when a task is submitted while no worker is idle,
+ * and then kept for later tasks, unless enough workers are already
+ * idle, in which case they exit. Hence a pool does not keep the threads
+ * of a past burst of tasks. Tasks added via the
+ * submit() method are run by the workers in the order in which they were
+ * added.
+ * The queue of pending tasks can optionally be bounded, in which case
+ * submit() blocks until a worker takes a task from a full queue.
+ * The workers are stopped (after finishing pending tasks) when the pool
+ * is destroyed.
+ */
+class ThreadPool {
+public:
+    /**
+     * Create a pool. No threads are started until tasks are submitted.
+     *
+     * @param numThreads The maximum number of worker threads. It can
+     * be zero, in which case parallelFor() runs everything on the calling
+     * thread and submit() must not be used.
+     *
+     * @param maxQueued The maximum number of tasks waiting in the queue
+     * for a worker. Zero means the queue is unbounded.
+     *
+     * @param maxIdle The maximum number of idle workers kept for later
+     * tasks. A worker that runs out of tasks exits if this many workers
+     * are already idle. By default, all the workers are kept.
+     */
+    explicit ThreadPool(const int numThreads, const size_t maxQueued = 0,
+        const int maxIdle = std::numeric_limits<int>::max());
+
+    /**
+     * Stops the workers after all pending tasks have been run.
+     */
+    ~ThreadPool();
+
+    /**
+     * Add a task to be run by one of the workers in the pool. If the
+     * queue is bounded and full, this method blocks until there is room.
+     *
+     * @param task The task to be run.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * Run a function on each index in the range [0, count) using up to
+     * a given number of threads, including the calling thread. Indices
+     * are handed out dynamically so that threads which finish early pick
+     * up more work. This method returns only after the function has been
+     * run for all the indices.
+     *
+     * @note The calling thread always participates. Hence, this method
+     * makes progress even if all the workers in the pool are busy.
+     *
+     * @param count The number of indices to process.
+     *
+     * @param maxThreads The maximum number of threads to use.
+     *
+     * @param func The function to be called with each index. It may be
+     * called concurrently from multiple threads.
+     */
+    void parallelFor(const int count, const int maxThreads,
+        const std::function<void(int)>& func);
+
+    /**
+     * Obtain the maximum number of worker threads in this pool.
+     *
+     * @return The maximum number of worker threads in this pool.
+     */
+    int size() const { return maxThreads; }
+
+private:
+    /**
+     * The method run by each worker thread. It repeatedly runs tasks from
+     * the queue until the pool is stopped or the worker is not needed.
+     *
+     * @param self The entry of this worker in the list of workers.
+     */
+    void workerMain(std::list<std::thread>::iterator self);
+
+    /** Join the workers that have exited. The caller must hold queueMutex */
+    void joinExited();
+
+    /** The maximum number of worker threads */
+    const int maxThreads;
+
+    /** The maximum number of idle workers kept for later tasks */
+    const int maxIdle;
+
+    /** The running worker threads */
+    std::list<std::thread> workers;
+
+    /** The workers that have exited but are yet to be joined */
+    std::vector<std::thread> exited;
+
+    /** The number of workers waiting for a task */
+    int idle = 0;
+
+    /** The queue of tasks yet to be run */
+    std::queue<std::function<void()>> tasks;
+
+    /** The mutex to protect the queue, the workers, and the stop flag */
+    std::mutex queueMutex;
+
+    /** The condition variable on which idle workers wait for tasks */
+    std::condition_variable queueCond;
+
+    /** The maximum number of tasks in the queue, or 0 for no limit */
+    const size_t maxQueued;
+
+    /** The condition variable on which submit() waits for room in a full
+     * queue.
+     */
+    std::condition_variable spaceCond;
+
+    /** Flag set by the destructor to stop the workers */
+    bool stop = false;
+};
+
+#endif /* THREAD_POOL_H */
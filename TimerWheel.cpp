@@ -0,0 +1,90 @@
+/* copyright caohd 2023
+ * Implementation of the hashed timer wheel used for the deadlines of wait
+ * queries.
+ */
+
+#include <chrono>
+#include "TimerWheel.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+TimerWheel::TimerWheel() : slots(NumSlots) {
+    thread = std::thread([this] { run(); });
+}
+
+TimerWheel::~TimerWheel() {
+    {
+        Guard g(wheelMutex);
+        stop = true;
+    }
+    wheelCond.notify_one();
+    thread.join();
+}
+
+uint64_t
+TimerWheel::add(const int64_t ms, std::function<void()> callback) {
+    // The number of ticks (at least one) until the timer expires
+    const uint64_t ticks = std::max<int64_t>(1, (ms + TickMs - 1) / TickMs);
+    Guard g(wheelMutex);
+    const size_t slot = (current + ticks) % NumSlots;
+    const uint64_t id = nextId++;
+    auto& timerList = slots[slot];
+    timerList.push_back(Timer{id, (ticks - 1) / NumSlots,
+        std::move(callback)});
+    timers[id] = {slot, std::prev(timerList.end())};
+    if (timers.size() == 1) {
+        wheelCond.notify_one();  // The thread may be sleeping
+    }
+    return id;
+}
+
+void
+TimerWheel::cancel(const uint64_t id) {
+    Guard g(wheelMutex);
+    const auto entry = timers.find(id);
+    if (entry != timers.end()) {
+        slots[entry->second.first].erase(entry->second.second);
+        timers.erase(entry);
+    }
+}
+
+void
+TimerWheel::run() {
+    using Clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> lock(wheelMutex);
+    auto nextTick = Clock::now() + std::chrono::milliseconds(TickMs);
+    while (!stop) {
+        if (timers.empty()) {
+            // Sleep until a timer is added. Ticks then restart from now.
+            wheelCond.wait(lock, [this] { return stop || !timers.empty(); });
+            nextTick = Clock::now() + std::chrono::milliseconds(TickMs);
+            continue;
+        }
+        if (wheelCond.wait_until(lock, nextTick) !=
+            std::cv_status::timeout) {
+            continue;  // Woken up to stop or spuriously
+        }
+        nextTick += std::chrono::milliseconds(TickMs);
+        current = (current + 1) % NumSlots;
+        // Collect the expired timers in the slot and run their callbacks
+        // without holding the mutex, as callbacks may take other locks.
+        std::vector<std::function<void()>> expired;
+        auto& timerList = slots[current];
+        for (auto timer = timerList.begin(); timer != timerList.end(); ) {
+            if (timer->rounds > 0) {
+                timer->rounds--;
+                timer++;
+            } else {
+                expired.push_back(std::move(timer->callback));
+                timers.erase(timer->id);
+                timer = timerList.erase(timer);
+            }
+        }
+        lock.unlock();
+        for (const auto& callback : expired) {
+            callback();
+        }
+        lock.lock();
+    }
+}
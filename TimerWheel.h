@@ -0,0 +1,114 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/*
+ * A hashed timer wheel that runs callbacks once their timeouts expire.
+ * It is used to enforce the deadlines of wait queries. All the timers
+ * share a single thread, so thousands of pending waits do not each need
+ * a thread (or a separate timed wait) of their own.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <list>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+/**
+ * A timer wheel with a fixed number of slots, where each slot covers one
+ * tick of time. A timer is added to the slot in which it expires, along
+ * with the number of full rotations of the wheel it must wait for. The
+ * thread of the wheel advances one slot per tick and runs the callbacks
+ * of the timers in the slot that have expired. Timers are accurate to
+ * within one tick.
+ */
+class TimerWheel {
+public:
+    /** The duration of each tick (i.e., slot) in milliseconds */
+    static constexpr int TickMs = 10;
+
+    /** The number of slots in the wheel */
+    static constexpr int NumSlots = 512;
+
+    /**
+     * Create the wheel and start its thread. The thread sleeps while
+     * there are no timers.
+     */
+    TimerWheel();
+
+    /**
+     * Stop the thread of the wheel. Pending timers are discarded without
+     * running their callbacks.
+     */
+    ~TimerWheel();
+
+    /**
+     * Add a timer.
+     *
+     * @param ms The number of milliseconds after which the timer expires.
+     *
+     * @param callback The function to be called (from the thread of the
+     * wheel) when the timer expires.
+     *
+     * @return The id of the timer that can be used to cancel it.
+     */
+    uint64_t add(const int64_t ms, std::function<void()> callback);
+
+    /**
+     * Cancel a timer whose callback has not yet been run. Cancelling a
+     * timer that has already expired has no effect. Note that the
+     * callback may be running (or about to run) when this method is
+     * called, so callbacks must not depend on the caller still existing.
+     *
+     * @param id The id of the timer returned by add().
+     */
+    void cancel(const uint64_t id);
+
+private:
+    /** A timer in a slot of the wheel */
+    struct Timer {
+        /** The id of the timer */
+        uint64_t id;
+
+        /** The number of rotations of the wheel until the timer expires */
+        uint64_t rounds;
+
+        /** The function to be called when the timer expires */
+        std::function<void()> callback;
+    };
+
+    /** The method run by the thread of the wheel */
+    void run();
+
+    /** The mutex to protect all the data in this wheel */
+    std::mutex wheelMutex;
+
+    /** The condition variable used to wake up the thread of the wheel */
+    std::condition_variable wheelCond;
+
+    /** Flag set by the destructor to stop the thread */
+    bool stop = false;
+
+    /** The timers in each slot of the wheel */
+    std::vector<std::list<Timer>> slots;
+
+    /** The slot corresponding to the current tick */
+    size_t current = 0;
+
+    /** The id of the next timer to be added */
+    uint64_t nextId = 1;
+
+    /** The slot and position of each pending timer, used to cancel it */
+    std::unordered_map<uint64_t, std::pair<size_t,
+        std::list<Timer>::iterator>> timers;
+
+    /** The thread that advances the wheel and runs expired timers */
+    std::thread thread;
+};
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,270 @@
+/* copyright caohd 2023
+ * Implementation of the list of queries waiting for the rows of a CSV to
+ * change.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include "WaitList.h"
+
+// A shortcut to refer to scoped_lock in code
+using Guard = std::scoped_lock<std::mutex>;
+
+uint64_t
+WaitList::getVersion() {
+    Guard g(listMutex);
+    return version;
+}
+
+WaitList::WaitList(TimerWheel& timers) : timers(timers) {
+}
+
+WaitList::Outcome
+WaitList::wait(const QueryPlan& plan, uint64_t& since,
+        std::vector<int>& changed, const Clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(listMutex);
+    if (version == since) {
+        // No update since the query checked the CSV. Any later update
+        // has to lock listMutex to notify, which it can do only once
+        // this thread is waiting.
+        if (deadline <= Clock::now()) {
+            return Outcome::TIMEOUT;
+        }
+        // The waiter is shared with the timer, whose callback may still
+        // run after this method returns.
+        const std::shared_ptr<Waiter> waiter(new Waiter{plan});
+        addWaiter(waiter, deadline);
+        waiter->cond.wait(lock, [&waiter] {
+            return waiter->woken && !waiter->matching; });
+        waiters.erase(waiter->pos);
+        if (waiter->timerId != 0) {
+            timers.cancel(waiter->timerId);
+        }
+        if (waiter->timedOut) {
+            return Outcome::TIMEOUT;
+        }
+    }
+    const bool known = changesSince(since, changed);
+    since = version;
+    return (known ? Outcome::CHANGED : Outcome::UNKNOWN);
+}
+
+void
+WaitList::waitAsync(const QueryPlan& plan, const uint64_t since,
+        const Clock::time_point deadline, Callback callback) {
+    std::unique_lock<std::mutex> lock(listMutex);
+    if (version == since && deadline > Clock::now()) {
+        // The waiter is owned by the list (and the timer) until it is
+        // woken up by notify() or the timer.
+        const std::shared_ptr<Waiter> waiter(new Waiter{plan});
+        waiter->since    = since;
+        waiter->callback = std::move(callback);
+        addWaiter(waiter, deadline);
+        return;
+    }
+    // There is no need to wait
+    std::vector<int> changed;
+    Outcome outcome = Outcome::TIMEOUT;
+    uint64_t current = since;
+    if (version != since) {
+        outcome = (changesSince(since, changed) ? Outcome::CHANGED :
+            Outcome::UNKNOWN);
+        current = version;
+    }
+    lock.unlock();
+    callback(outcome, current, changed);
+}
+
+void
+WaitList::addWaiter(const std::shared_ptr<Waiter>& waiter,
+        const Clock::time_point deadline) {
+    waiter->pos = waiters.insert(waiters.end(), waiter);
+    if (deadline != Clock::time_point::max()) {
+        const auto ms = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - Clock::now()).count();
+        waiter->timerId = timers.add(ms, [this, waiter] { expire(waiter); });
+    }
+}
+
+void
+WaitList::expire(const std::shared_ptr<Waiter>& waiter) {
+    std::unique_lock<std::mutex> lock(listMutex);
+    if (waiter->woken) {
+        return;  // Already woken up by an update
+    }
+    waiter->woken = waiter->timedOut = true;
+    if (waiter->matching) {
+        return;  // The update checking the waiter finishes it
+    }
+    if (!waiter->callback) {
+        waiter->cond.notify_one();
+        return;
+    }
+    const Woken woken = finish(*waiter);
+    lock.unlock();
+    woken.callback(woken.outcome, woken.version, woken.changed);
+}
+
+WaitList::Woken
+WaitList::finish(Waiter& waiter) {
+    Woken woken{std::move(waiter.callback), Outcome::TIMEOUT, waiter.since,
+        {}};
+    if (!waiter.timedOut) {
+        if (waiter.timerId != 0) {
+            timers.cancel(waiter.timerId);
+        }
+        woken.outcome = (changesSince(waiter.since, woken.changed) ?
+            Outcome::CHANGED : Outcome::UNKNOWN);
+        woken.version = version;
+    }
+    waiters.erase(waiter.pos);
+    return woken;
+}
+
+bool
+WaitList::changesSince(const uint64_t since,
+        std::vector<int>& changed) const {
+    changed.clear();
+    if (since < loggedSince || since > version) {
+        return false;
+    }
+    const auto first = std::upper_bound(changeLog.begin(), changeLog.end(),
+        since, [](const uint64_t ver, const LogEntry& entry) {
+            return ver < entry.version; });
+    for (auto entry = first; entry != changeLog.end(); entry++) {
+        changed.push_back(entry->row);
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()),
+        changed.end());
+    return true;
+}
+
+bool
+WaitList::addSubscriber(Subscriber& sub, uint64_t& since,
+        std::vector<int>& changed) {
+    Guard g(listMutex);
+    const bool known = changesSince(since, changed);
+    since = version;
+    subscribers.push_back(&sub);
+    return known;
+}
+
+void
+WaitList::removeSubscriber(Subscriber& sub) {
+    // An update may be checking rows against the query of the subscriber
+    Guard n(notifyMutex);
+    Guard g(listMutex);
+    subscribers.remove(&sub);
+}
+
+bool
+WaitList::getChanges(Subscriber& sub, uint64_t& since,
+        std::vector<Change>& changes) {
+    changes.clear();
+    Guard g(listMutex);
+    const bool known = !sub.overflowed;
+    changes.assign(std::make_move_iterator(sub.changes.begin()),
+        std::make_move_iterator(sub.changes.end()));
+    sub.changes.clear();
+    sub.overflowed = false;
+    since = version;
+    return known;
+}
+
+void
+WaitList::notify(CSV& csv, const std::vector<int>& rows) {
+    std::unique_lock<std::mutex> notifyLock(notifyMutex);
+    std::unique_lock<std::mutex> lock(listMutex);
+    version++;
+    // Make room for the changed rows before logging them. If there are
+    // more rows than the log can hold, none of them are logged.
+    if (rows.size() > MaxLogSize) {
+        changeLog.clear();
+        loggedSince = version;
+    } else {
+        while (changeLog.size() + rows.size() > MaxLogSize) {
+            loggedSince = changeLog.front().version;
+            changeLog.pop_front();
+        }
+        for (const int r : rows) {
+            changeLog.push_back(LogEntry{version, r});
+        }
+    }
+    if (waiters.empty() && subscribers.empty()) {
+        return;
+    }
+    // Take a snapshot of the waiters and subscribers. The waiters are
+    // not finished while they are being matched, and the subscribers are
+    // not removed until notifyMutex is released.
+    std::vector<std::shared_ptr<Waiter>> pending;
+    for (const auto& waiter : waiters) {
+        if (!waiter->woken) {
+            waiter->matching = true;
+            pending.push_back(waiter);
+        }
+    }
+    const std::vector<Subscriber*> subs(subscribers.begin(),
+        subscribers.end());
+    const uint64_t changedVersion = version;
+    lock.unlock();
+    // Check the current values of the changed rows without holding
+    // listMutex. If a row has since been changed again, the later update
+    // queues its values again.
+    std::vector<bool> matched(pending.size());
+    std::vector<std::deque<Change>> queued(subs.size());
+    for (const int r : rows) {
+        Guard rowGuard(csv[r].rowMutex);
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (!matched[i] && pending[i]->plan.matches(csv[r])) {
+                matched[i] = true;
+            }
+        }
+        for (size_t i = 0; i < subs.size(); i++) {
+            // Stop copying rows once the queue would overflow anyway
+            if (queued[i].size() <= MaxQueued &&
+                subs[i]->plan.matches(csv[r])) {
+                queued[i].push_back(Change{changedVersion, r, ""});
+                subs[i]->plan.appendRow(csv[r], queued[i].back().rowText);
+            }
+        }
+    }
+    lock.lock();
+    for (size_t i = 0; i < subs.size(); i++) {
+        Subscriber& sub = *subs[i];
+        if (sub.overflowed || queued[i].empty()) {
+            continue;
+        }
+        if (sub.changes.size() + queued[i].size() > MaxQueued) {
+            // Drop the queue rather than keeping any more rows
+            sub.changes.clear();
+            sub.overflowed = true;
+            continue;
+        }
+        std::move(queued[i].begin(), queued[i].end(),
+            std::back_inserter(sub.changes));
+    }
+    // Wake up the waiters that matched (or whose deadline passed while
+    // they were being matched). The asynchronous ones are removed and
+    // their callbacks are called once the locks are released, as the
+    // callbacks may remove subscribers.
+    std::vector<Woken> woken;
+    for (size_t i = 0; i < pending.size(); i++) {
+        Waiter& waiter = *pending[i];
+        waiter.matching = false;
+        waiter.woken    = waiter.woken || matched[i];
+        if (!waiter.woken) {
+            continue;
+        }
+        if (!waiter.callback) {
+            waiter.cond.notify_one();
+        } else {
+            woken.push_back(finish(waiter));
+        }
+    }
+    lock.unlock();
+    notifyLock.unlock();
+    for (const auto& waiter : woken) {
+        waiter.callback(waiter.outcome, waiter.version, waiter.changed);
+    }
+}
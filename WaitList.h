@@ -0,0 +1,381 @@
+#ifndef WAIT_LIST_H
+#define WAIT_LIST_H
+
+/*
+ * The list of queries ("wait select" and "wait update") that are waiting
+ * for the rows of a CSV to change. Each waiter is registered along with
+ * its compiled query, so that an update only wakes up the waiters whose
+ * where clause matches at least one of the rows changed by the update.
+ * Other waiters keep sleeping instead of rescanning the CSV.
+ *
+ * The list also keeps a log of the rows changed by recent updates. Each
+ * update increments the version of the CSV, and a woken waiter obtains
+ * the rows changed since the version at which it last checked the CSV.
+ * So it only has to recheck those rows instead of the whole CSV. The log
+ * has only the indices of the rows. The values of the changed rows are
+ * copied only for active subscriptions, and only the selected values of
+ * the rows that match the where clause of each subscription.
+ *
+ * Waiters read the version before checking the CSV and only go to sleep
+ * if the version is still the same (checked while holding the mutex that
+ * updates hold to increment it). So an update that lands between the
+ * check and the wait is never missed.
+ *
+ * An update holds the mutex of the list only to increment the version and
+ * to take a snapshot of the waiters and subscribers. It checks the changed
+ * rows against their queries without holding the mutex, so that new waits
+ * and expiring deadlines do not stall behind large updates.
+ *
+ * Waits can have a deadline. The deadlines of all the waiters are kept in
+ * a shared timer wheel, which wakes up a waiter once its deadline passes.
+ *
+ * Waiters either block their thread in wait() or register a callback via
+ * waitAsync(). The asynchronous server uses the latter, so that sleeping
+ * queries and subscriptions do not hold a thread.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <list>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <climits>
+#include <condition_variable>
+#include "QueryPlan.h"
+#include "TimerWheel.h"
+
+/**
+ * A thread-safe list of the waiters on a CSV along with the log of the
+ * rows changed in the CSV. There is one list per CSV.
+ */
+class WaitList {
+public:
+    /** The clock used for the deadlines of waits */
+    using Clock = std::chrono::steady_clock;
+
+    /** The reasons for which wait() returns */
+    enum class Outcome {
+        /** The rows changed since the given version are known */
+        CHANGED,
+        /** The log no longer has the changes. So rescan the whole CSV */
+        UNKNOWN,
+        /** The deadline passed before a matching row was changed */
+        TIMEOUT
+    };
+
+    /** A change to a row that matches the query of a subscription */
+    struct Change {
+        /** The version of the CSV created by the update */
+        uint64_t version;
+
+        /** The index of the row that was changed */
+        int row;
+
+        /** The selected values of the row when the change was made, as
+         * appended by QueryPlan::appendRow()
+         */
+        std::string rowText;
+    };
+
+    /**
+     * A subscription to the changes to the rows that match a query. While
+     * it is registered, each update queues the rows it changes that match
+     * the query.
+     */
+    struct Subscriber {
+        /** Create a subscriber that has not yet been registered */
+        explicit Subscriber(const QueryPlan& plan) : plan(plan) {}
+
+        /** The compiled query whose matching rows are queued */
+        const QueryPlan& plan;
+
+        /** The changes not yet obtained by getChanges() */
+        std::deque<Change> changes;
+
+        /** Flag set if changes were dropped as the queue was full */
+        bool overflowed = false;
+    };
+
+    /**
+     * Create an empty list of waiters.
+     *
+     * @param timers The timer wheel used to enforce the deadlines of
+     * waits. It must outlive this list.
+     */
+    explicit WaitList(TimerWheel& timers);
+
+    /**
+     * The maximum number of changed rows kept in the log. Waiters that
+     * fall further behind have to rescan the whole CSV.
+     */
+    static constexpr size_t MaxLogSize = 64 * 1024;
+
+    /**
+     * The maximum number of changes queued for a subscriber. Once it is
+     * reached, further changes are dropped until the subscriber obtains
+     * the queued ones, and the subscriber is then told to rerun its query.
+     */
+    static constexpr size_t MaxQueued = 4096;
+
+    /**
+     * Obtain the current version of the CSV. Waiters must obtain the
+     * version before checking the rows of the CSV.
+     *
+     * @return The number of updates that have changed rows in the CSV.
+     */
+    uint64_t getVersion();
+
+    /**
+     * Block the calling thread until an update changes a row that matches
+     * the where clause of a given query or a deadline passes. The thread
+     * does not block if the CSV has been changed since a given version.
+     *
+     * @param plan The compiled query that is waiting.
+     *
+     * @param since The version of the CSV when the query last checked
+     * the CSV. On return, it is set to the current version.
+     *
+     * @param changed On return, the indices (in ascending order and
+     * without duplicates) of the rows changed after version since.
+     *
+     * @param deadline The time after which the wait is abandoned. Use
+     * Clock::time_point::max() to wait without a deadline.
+     *
+     * @return CHANGED if changed has all the rows changed after version
+     * since. UNKNOWN if the log no longer has the changes, in which case
+     * the whole CSV must be rechecked. TIMEOUT if the deadline passed
+     * first, in which case since and changed are not modified.
+     */
+    Outcome wait(const QueryPlan& plan, uint64_t& since,
+        std::vector<int>& changed, const Clock::time_point deadline);
+
+    /**
+     * The function called when an asynchronous wait ends. It is given the
+     * outcome of the wait (see wait()), the version of the CSV and the
+     * rows changed since the version at which the wait started. If the
+     * outcome is TIMEOUT, the version is the one at which the wait started
+     * and no rows are given.
+     */
+    using Callback = std::function<void(const Outcome, const uint64_t,
+        const std::vector<int>&)>;
+
+    /**
+     * Wait without blocking the calling thread until an update changes a
+     * row that matches the where clause of a given query or a deadline
+     * passes. Then call a given callback without holding any lock of this
+     * list. The callback is called by the thread that calls notify(), by
+     * the thread of the timer wheel, or by the calling thread (before this
+     * method returns) if the CSV has been changed since a given version.
+     * So it must not block.
+     *
+     * @param plan The compiled query that is waiting. It must remain
+     * valid until the callback has been called.
+     *
+     * @param since The version of the CSV when the query last checked
+     * the CSV.
+     *
+     * @param deadline The time after which the wait is abandoned. Use
+     * Clock::time_point::max() to wait without a deadline.
+     *
+     * @param callback The function called once the wait ends.
+     */
+    void waitAsync(const QueryPlan& plan, const uint64_t since,
+        const Clock::time_point deadline, Callback callback);
+
+    /**
+     * Register a subscriber, so that the changes made from now on to the
+     * rows matching its query are queued for it.
+     *
+     * @param sub The subscriber to be registered. It must be removed
+     * with removeSubscriber() before it is destroyed.
+     *
+     * @param since The version of the CSV after which the subscriber
+     * needs the changes. On return, it is set to the current version.
+     *
+     * @param changed On return, the indices (in ascending order and
+     * without duplicates) of the rows changed after version since and
+     * up to the current version. These changes are not queued.
+     *
+     * @return False if the log no longer has all the changes after
+     * version since (or since is not a valid version), in which case
+     * changed is empty.
+     */
+    bool addSubscriber(Subscriber& sub, uint64_t& since,
+        std::vector<int>& changed);
+
+    /**
+     * Unregister a subscriber added by addSubscriber(). This method waits
+     * for any update that is checking rows against its query.
+     *
+     * @param sub The subscriber to be removed.
+     */
+    void removeSubscriber(Subscriber& sub);
+
+    /**
+     * Obtain the changes queued for a subscriber, without blocking.
+     *
+     * @param sub The registered subscriber.
+     *
+     * @param since On return, it is set to the current version.
+     *
+     * @param changes On return, the queued changes in the order in which
+     * they were made.
+     *
+     * @return False if changes were dropped as the queue was full. The
+     * changes made after the current version are queued again.
+     */
+    bool getChanges(Subscriber& sub, uint64_t& since,
+        std::vector<Change>& changes);
+
+    /**
+     * Record the rows changed by an update in the log, queue the rows for
+     * the subscribers whose query they match, and wake up the waiters
+     * whose where clause matches at least one of the rows. This method
+     * must be called after the rows have been changed (and their mutexes
+     * unlocked).
+     *
+     * @param csv The CSV that was updated.
+     *
+     * @param rows The indices of the rows that were changed.
+     */
+    void notify(CSV& csv, const std::vector<int>& rows);
+
+private:
+    /** A query waiting in the wait() or waitAsync() method */
+    struct Waiter {
+        /** The compiled query with the where clause to be checked */
+        const QueryPlan& plan;
+
+        /** The condition variable on which the query is waiting */
+        std::condition_variable cond;
+
+        /** Flag set by notify() or the timer to wake up this waiter */
+        bool woken = false;
+
+        /** Flag set by the timer if the deadline passed */
+        bool timedOut = false;
+
+        /** Flag set while notify() checks rows against the plan without
+         * holding listMutex. The waiter is finished (and the plan may be
+         * destroyed) only once it is cleared.
+         */
+        bool matching = false;
+
+        /** The version at which an asynchronous wait started */
+        uint64_t since = 0;
+
+        /** The callback of an asynchronous wait. It is empty for waiters
+         * blocked in wait(), and once it has been taken to be called.
+         */
+        Callback callback;
+
+        /** The id of the timer for the deadline, or 0 if there is none */
+        uint64_t timerId = 0;
+
+        /** The position of this waiter in the list of waiters */
+        std::list<std::shared_ptr<Waiter>>::iterator pos;
+    };
+
+    /**
+     * Add a waiter to the list, along with a timer for its deadline.
+     * The caller must hold listMutex.
+     *
+     * @param waiter The waiter to be added.
+     *
+     * @param deadline The time after which the wait is abandoned.
+     */
+    void addWaiter(const std::shared_ptr<Waiter>& waiter,
+        const Clock::time_point deadline);
+
+    /**
+     * Wake up a waiter whose deadline passed, if it has not already been
+     * woken up. This method is called by the thread of the timer wheel.
+     *
+     * @param waiter The waiter whose deadline passed.
+     */
+    void expire(const std::shared_ptr<Waiter>& waiter);
+
+    /** An asynchronous waiter that was woken up, to be called back */
+    struct Woken {
+        /** The callback of the waiter */
+        Callback callback;
+
+        /** The outcome of the wait */
+        Outcome outcome;
+
+        /** The version passed to the callback */
+        uint64_t version;
+
+        /** The rows changed since the wait started */
+        std::vector<int> changed;
+    };
+
+    /**
+     * Remove an asynchronous waiter that was woken up from the list. The
+     * caller must hold listMutex, and call the callback once it releases
+     * the mutex.
+     *
+     * @param waiter The waiter that was woken up by an update or the timer.
+     *
+     * @return The callback of the waiter along with its arguments.
+     */
+    Woken finish(Waiter& waiter);
+
+    /**
+     * Obtain the rows changed after a given version from the log. The
+     * caller must hold listMutex.
+     *
+     * @param since The version after which changes are needed.
+     *
+     * @param changed The indices of the changed rows, in ascending order
+     * and without duplicates.
+     *
+     * @return False if the log no longer has all the changes.
+     */
+    bool changesSince(const uint64_t since, std::vector<int>& changed) const;
+
+    /** The index of a row changed by an update, recorded in the log */
+    struct LogEntry {
+        /** The version of the CSV created by the update */
+        uint64_t version;
+
+        /** The index of the row that was changed */
+        int row;
+    };
+
+    /** The timer wheel that wakes up waiters whose deadline passes */
+    TimerWheel& timers;
+
+    /** The mutex to protect all the data in this list */
+    std::mutex listMutex;
+
+    /**
+     * The mutex held by notify() throughout, so that updates queue their
+     * changes in the order of their versions. It is locked before
+     * listMutex.
+     */
+    std::mutex notifyMutex;
+
+    /** The waiters currently blocked in wait() or waiting asynchronously */
+    std::list<std::shared_ptr<Waiter>> waiters;
+
+    /** The version of the CSV, incremented by each call to notify() */
+    uint64_t version = 0;
+
+    /** The subscribers currently registered */
+    std::list<Subscriber*> subscribers;
+
+    /** The log of changed rows in ascending order of versions */
+    std::deque<LogEntry> changeLog;
+
+    /** The log has all the changes made after this version */
+    uint64_t loggedSince = 0;
+};
+
+#endif /* WAIT_LIST_H */
@@ -0,0 +1,467 @@
+/* copyright caohd 2023
+ * Implementation of the WhereExpr class that parses, optimizes, and
+ * evaluates the boolean expression in the where clause of a query.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+#include "WhereExpr.h"
+#include "Helper.h"
+
+// Convert a string to a number. Returns NaN if the whole string is not
+// a valid number.
+double
+WhereExpr::toNumber(const std::string& str) {
+    if (str.empty()) {
+        return std::nan("");
+    }
+    char* end = nullptr;
+    const double num = std::strtod(str.c_str(), &end);
+    return (*end == '\0' ? num : std::nan(""));
+}
+
+// Convert the condition in a query to the corresponding enumeration
+static WhereExpr::CondOp toCondOp(const std::string& cond) {
+    using CondOp = WhereExpr::CondOp;
+    if (cond == "=")                   return CondOp::EQ;
+    if (cond == "<>" || cond == "!=")  return CondOp::NE;
+    if (cond == "like")                return CondOp::LIKE;
+    if (cond == "<")                   return CondOp::LT;
+    if (cond == "<=")                  return CondOp::LE;
+    if (cond == ">")                   return CondOp::GT;
+    if (cond == ">=")                  return CondOp::GE;
+    if (cond == "in")                  return CondOp::IN;
+    return CondOp::INVALID;
+}
+
+// Convert a range condition to the comparison used by the SIMD kernels
+static kernels::Cmp toCmp(const WhereExpr::CondOp op) {
+    using CondOp = WhereExpr::CondOp;
+    switch (op) {
+    case CondOp::LT: return kernels::Cmp::LT;
+    case CondOp::LE: return kernels::Cmp::LE;
+    case CondOp::GT: return kernels::Cmp::GT;
+    default:         return kernels::Cmp::GE;
+    }
+}
+
+// Convenience method to check if a bit in a mask is set
+static inline bool isSet(const kernels::Mask mask, const int bit) {
+    return (mask[bit / 64] >> (bit % 64)) & 1;
+}
+
+WhereExpr::WhereExpr(const int colIdx, const std::string& cond,
+        const std::string& value) : colIdx(colIdx) {
+    if (colIdx != -1) {
+        kind   = Kind::PRED;
+        op     = toCondOp(cond);
+        values = {value};
+        number = toNumber(value);
+        if (op == CondOp::LIKE) {
+            like = kernels::SubstrMatcher(value);
+        }
+    }
+    optimize();
+}
+
+// ---------------------------[ Parsing ]-----------------------------
+
+namespace {
+/**
+ * A simple recursive descent parser for where clauses. The grammar is:
+ *
+ *     or   := and { "or" and }
+ *     and  := not { "and" not }
+ *     not  := "not" not | "(" or ")" | pred
+ *     pred := col [not] cond value | col [not] "in" "(" value {value} ")"
+ *
+ * Note that the commas in an IN-list are already removed by the tokenizer.
+ */
+class WhereParser {
+public:
+    WhereParser(const CSV& csv, const StrVec& sql, size_t& idx,
+        const StrVec& stopWords) : csv(csv) {
+        // Gather the tokens in the where clause, splitting tokens such
+        // as "((" (the tokenizer combines consecutive parentheses)
+        int depth = 0;
+        for (; idx < sql.size(); idx++) {
+            const std::string& tok = sql[idx];
+            if (depth == 0 && Helper::find(stopWords, tok) != -1) {
+                break;
+            }
+            if (!tok.empty() && tok.find_first_not_of("()") ==
+                std::string::npos) {
+                for (const char paren : tok) {
+                    toks.push_back(std::string(1, paren));
+                    depth += (paren == '(' ? 1 : -1);
+                }
+            } else {
+                toks.push_back(tok);
+            }
+        }
+    }
+
+    WhereExpr parse() {
+        WhereExpr expr = parseOr();
+        if (pos != toks.size()) {
+            throw Exp("Invalid where clause in query");
+        }
+        return expr;
+    }
+
+private:
+    // Return the next token without consuming it.
+    const std::string& peek() const {
+        static const std::string End = "";
+        return (pos < toks.size() ? toks[pos] : End);
+    }
+
+    // Consume and return the next token. Throws if there are no tokens.
+    const std::string& next() {
+        if (pos >= toks.size()) {
+            throw Exp("Invalid where clause in query");
+        }
+        return toks[pos++];
+    }
+
+    // Parse a list of sub-expressions separated by a given keyword
+    WhereExpr parseList(const std::string& keyword, const WhereExpr::Kind kind,
+        WhereExpr (WhereParser::*parseChild)()) {
+        WhereExpr first = (this->*parseChild)();
+        if (peek() != keyword) {
+            return first;
+        }
+        WhereExpr expr;
+        expr.kind = kind;
+        expr.children.push_back(std::move(first));
+        while (peek() == keyword) {
+            pos++;
+            expr.children.push_back((this->*parseChild)());
+        }
+        return expr;
+    }
+
+    WhereExpr parseOr() {
+        return parseList("or", WhereExpr::Kind::OR, &WhereParser::parseAnd);
+    }
+
+    WhereExpr parseAnd() {
+        return parseList("and", WhereExpr::Kind::AND, &WhereParser::parseNot);
+    }
+
+    WhereExpr parseNot() {
+        if (peek() != "not" && peek() != "(") {
+            return parsePred();
+        }
+        if (++nesting > WhereExpr::MaxDepth) {
+            throw Exp("Where clause in query is nested too deeply");
+        }
+        WhereExpr expr;
+        if (next() == "not") {
+            expr = negate(parseNot());
+        } else {
+            expr = parseOr();
+            if (next() != ")") {
+                throw Exp("Invalid where clause in query");
+            }
+        }
+        nesting--;
+        return expr;
+    }
+
+    WhereExpr parsePred() {
+        const std::string& col = next();
+        const int colIdx = csv.getColumnIndex(col);
+        if (colIdx == -1) {
+            throw Exp("Invalid column " + col + " in where clause.");
+        }
+        // Handle optional "not" in "not like" or "not in"
+        const bool isNot = (peek() == "not");
+        pos += isNot;
+        const std::string& cond = next();
+        if (toCondOp(cond) == WhereExpr::CondOp::INVALID) {
+            throw Exp("Invalid where clause in query");
+        }
+        WhereExpr expr(colIdx, cond, "");
+        if (expr.op == WhereExpr::CondOp::IN) {
+            if (next() != "(") {
+                throw Exp("Invalid where clause in query");
+            }
+            expr.values.clear();
+            for (std::string val; (val = next()) != ")"; ) {
+                expr.values.push_back(val);
+            }
+            if (expr.values.empty()) {
+                throw Exp("Invalid where clause in query");
+            }
+        } else {
+            expr = WhereExpr(colIdx, cond, next());
+        }
+        return (isNot ? negate(std::move(expr)) : expr);
+    }
+
+    // Wrap an expression in a "not" node
+    static WhereExpr negate(WhereExpr child) {
+        WhereExpr expr;
+        expr.kind = WhereExpr::Kind::NOT;
+        expr.children.push_back(std::move(child));
+        return expr;
+    }
+
+    /** The CSV used to resolve the column names */
+    const CSV& csv;
+
+    /** The tokens in the where clause */
+    StrVec toks;
+
+    /** The index of the next token to be parsed in toks */
+    size_t pos = 0;
+
+    /** The number of enclosing parentheses and "not" being parsed */
+    int nesting = 0;
+};
+}  // namespace
+
+WhereExpr
+WhereExpr::parse(const CSV& csv, const StrVec& sql, size_t& idx,
+        const StrVec& stopWords) {
+    WhereExpr expr = WhereParser(csv, sql, idx, stopWords).parse();
+    expr.optimize();
+    return expr;
+}
+
+// ---------------------------[ Optimizing ]--------------------------
+
+void
+WhereExpr::optimize() {
+    // The rank used to order the children of "and" and "or" nodes. For
+    // "and" the rank favors cheap conditions that reject many rows while
+    // for "or" it favors cheap conditions that accept many rows.
+    const auto rank = [this](const WhereExpr& e) {
+        const double useful = (kind == Kind::AND ? 1 - e.selectivity :
+            e.selectivity);
+        return (useful > 0 ? e.cost / useful :
+            std::numeric_limits<double>::infinity());
+    };
+    switch (kind) {
+    case Kind::NONE:
+        selectivity = 1;
+        cost        = 0;
+        break;
+    case Kind::PRED:
+        // Without statistics on the data, use typical estimates for each
+        // condition. Strings are compared with memcmp for EQ/NE/IN, range
+        // checks need the number to be parsed, and like is a search.
+        switch (op) {
+        case CondOp::EQ:   selectivity = 0.05; cost = 1;   break;
+        case CondOp::NE:   selectivity = 0.95; cost = 1;   break;
+        case CondOp::IN:
+            selectivity = std::min(0.05 * values.size(), 0.5);
+            cost = values.size();
+            break;
+        case CondOp::LIKE: selectivity = 0.25; cost = 4 + values[0].size();
+            break;
+        case CondOp::INVALID: selectivity = 0; cost = 0; break;
+        default:           selectivity = 0.33; cost = 2;   break;
+        }
+        break;
+    case Kind::NOT:
+        children[0].optimize();
+        selectivity = 1 - children[0].selectivity;
+        cost        = children[0].cost;
+        break;
+    case Kind::AND:
+    case Kind::OR: {
+        for (auto& child : children) {
+            child.optimize();
+        }
+        std::stable_sort(children.begin(), children.end(),
+            [&rank](const WhereExpr& a, const WhereExpr& b) {
+                return rank(a) < rank(b); });
+        // Each child is only checked on rows that are still undecided
+        double undecided = 1;
+        cost = 0;
+        for (const auto& child : children) {
+            cost      += undecided * child.cost;
+            undecided *= (kind == Kind::AND ? child.selectivity :
+                1 - child.selectivity);
+        }
+        selectivity = (kind == Kind::AND ? undecided : 1 - undecided);
+        break;
+    }
+    }
+}
+
+// ---------------------------[ Evaluating ]--------------------------
+
+bool
+WhereExpr::check(const std::string& cell) const {
+    switch (op) {
+    case CondOp::EQ:   return cell == values[0];
+    case CondOp::NE:   return cell != values[0];
+    case CondOp::LIKE: return like.matches(cell);
+    case CondOp::IN:
+        return std::find(values.begin(), values.end(), cell) != values.end();
+    case CondOp::INVALID: return false;
+    default:
+        break;
+    }
+    // Range conditions compare numbers if the value is a number.
+    // Otherwise the strings are compared.
+    const double diff = (std::isnan(number) ? cell.compare(values[0]) :
+        toNumber(cell) - number);
+    switch (op) {
+    case CondOp::LT: return diff <  0;
+    case CondOp::LE: return diff <= 0;
+    case CondOp::GT: return diff >  0;
+    default:         return diff >= 0;
+    }
+}
+
+bool
+WhereExpr::matches(const CSVRow& row) const {
+    switch (kind) {
+    case Kind::NONE: return true;
+    case Kind::PRED: return check(row[colIdx]);
+    case Kind::NOT:  return !children[0].matches(row);
+    case Kind::AND:
+        for (const auto& child : children) {
+            if (!child.matches(row)) return false;
+        }
+        return true;
+    case Kind::OR:
+        for (const auto& child : children) {
+            if (child.matches(row)) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+int
+WhereExpr::filterPred(const CSV& csv, const int* in, const int inCount,
+        int* out) const {
+    kernels::Mask mask;
+    int count = 0;
+    switch (op) {
+    case CondOp::EQ:
+    case CondOp::NE:
+    case CondOp::IN: {
+        // Gather the column chunk and have a SIMD kernel find candidates
+        kernels::StrChunk chunk;
+        for (int i = 0; i < inCount; i++) {
+            chunk.add(csv[in[i]][colIdx]);
+        }
+        const bool exact = kernels::eqMask(chunk, values, mask);
+        const bool wantEq = (op != CondOp::NE);
+        for (int i = 0; i < inCount; i++) {
+            const int row = in[i];
+            bool isEq = isSet(mask, i);
+            // Candidates are verified only for values longer than 8 bytes
+            if (isEq && !exact) {
+                const std::string& cell = csv[row][colIdx];
+                isEq = std::find(values.begin(), values.end(), cell) !=
+                    values.end();
+            }
+            out[count] = row;
+            count += (isEq == wantEq);
+        }
+        return count;
+    }
+    case CondOp::LT:
+    case CondOp::LE:
+    case CondOp::GT:
+    case CondOp::GE:
+        if (!std::isnan(number)) {
+            // Parse the column chunk and have a SIMD kernel compare it
+            kernels::NumChunk chunk;
+            for (int i = 0; i < inCount; i++) {
+                chunk.add(toNumber(csv[in[i]][colIdx]));
+            }
+            kernels::cmpMask(chunk, toCmp(op), number, mask);
+            for (int i = 0; i < inCount; i++) {
+                out[count] = in[i];
+                count += isSet(mask, i);
+            }
+            return count;
+        }
+        break;
+    default:
+        break;
+    }
+    // The remaining conditions are checked one value at a time
+    for (int i = 0; i < inCount; i++) {
+        const int row = in[i];
+        out[count] = row;
+        count += check(csv[row][colIdx]);
+    }
+    return count;
+}
+
+int
+WhereExpr::filter(const CSV& csv, const int* in, const int inCount,
+        int* out) const {
+    switch (kind) {
+    case Kind::NONE:
+        std::copy_n(in, inCount, out);
+        return inCount;
+    case Kind::PRED:
+        return filterPred(csv, in, inCount, out);
+    case Kind::AND: {
+        // Each child only checks the rows accepted by the earlier ones
+        int count = children[0].filter(csv, in, inCount, out);
+        for (size_t c = 1; c < children.size() && count > 0; c++) {
+            count = children[c].filter(csv, out, count, out);
+        }
+        return count;
+    }
+    case Kind::OR: {
+        // Each child only checks the rows not accepted by the earlier ones.
+        // The accepted rows are tracked by their position in the input.
+        bool accepted[kernels::ChunkSize];
+        std::fill_n(accepted, inCount, false);
+        int remaining[kernels::ChunkSize], remPos[kernels::ChunkSize];
+        int matched[kernels::ChunkSize], remCount = inCount;
+        for (int i = 0; i < inCount; i++) {
+            remaining[i] = in[i];
+            remPos[i]    = i;
+        }
+        for (size_t c = 0; c < children.size() && remCount > 0; c++) {
+            const int matchCount = children[c].filter(csv, remaining,
+                remCount, matched);
+            int newCount = 0;
+            for (int i = 0, m = 0; i < remCount; i++) {
+                if (m < matchCount && matched[m] == remaining[i]) {
+                    accepted[remPos[i]] = true;
+                    m++;
+                } else {
+                    remaining[newCount] = remaining[i];
+                    remPos[newCount++]  = remPos[i];
+                }
+            }
+            remCount = newCount;
+        }
+        int count = 0;
+        for (int i = 0; i < inCount; i++) {
+            out[count] = in[i];
+            count += accepted[i];
+        }
+        return count;
+    }
+    case Kind::NOT: {
+        int matched[kernels::ChunkSize];
+        const int matchCount = children[0].filter(csv, in, inCount, matched);
+        int count = 0;
+        for (int i = 0, m = 0; i < inCount; i++) {
+            const bool isMatch = (m < matchCount && matched[m] == in[i]);
+            m += isMatch;
+            out[count] = in[i];
+            count += !isMatch;
+        }
+        return count;
+    }
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#ifndef WHERE_EXPR_H
+#define WHERE_EXPR_H
+
+/*
+ * A boolean expression tree for the where clause of a query. Where
+ * clauses can combine conditions using "and", "or", "not", and
+ * parentheses, for example:
+ *
+ *     select * from test.csv where (year = 2006 or year > 2015)
+ *         and title like 'The';
+ *
+ * The conditions in an "and" or an "or" are reordered based on their
+ * estimated cost and selectivity, so that cheap and selective conditions
+ * are checked first and short-circuit the rest.
+ *
+ * Copyright (C) 2023 caohd
+ */
+
+#include <string>
+#include <vector>
+#include "CSV.h"
+#include "Kernels.h"
+
+/**
+ * A node in the expression tree of a where clause. A node is either a
+ * single condition on a column (a predicate) or a combination of other
+ * nodes via "and", "or", or "not". An empty where clause is represented
+ * by a node of kind NONE, which matches every row.
+ */
+class WhereExpr {
+public:
+    /** The different kinds of nodes in the expression tree */
+    enum class Kind { NONE, PRED, AND, OR, NOT };
+
+    /**
+     * The conditions that can be used in a predicate. The EQ, NE, and
+     * LIKE conditions compare strings. The range conditions compare
+     * numbers if the value is a number and strings otherwise. IN checks
+     * if the column is equal to one of a list of values.
+     */
+    enum class CondOp { EQ, NE, LIKE, LT, LE, GT, GE, IN, INVALID };
+
+    /**
+     * The maximum nesting of parentheses and "not" in a where clause.
+     * Parsing and filtering recurse once per level, so deeper clauses are
+     * rejected rather than risk overflowing the stack of a worker.
+     */
+    static constexpr int MaxDepth = 64;
+
+    /**
+     * Create an empty where clause that matches every row.
+     */
+    WhereExpr() {}
+
+    /**
+     * Create a single predicate of the form "col cond value".
+     *
+     * @param colIdx The index of the column in the CSV. If this value is
+     * -1, then an empty where clause is created.
+     *
+     * @param cond The condition, e.g., "=", "<>", "like", "<", or ">=".
+     *
+     * @param value The value to compare against.
+     */
+    WhereExpr(const int colIdx, const std::string& cond,
+        const std::string& value);
+
+    /**
+     * Parse a where clause from the tokens of a query produced by the
+     * CSV::tokenize() method. The where clause starts at a given index
+     * (just after the "where" keyword) and ends at the end of the tokens
+     * or at one of the given stop words (outside of parentheses).
+     *
+     * @param csv The CSV used to resolve column names in the where clause.
+     *
+     * @param sql The tokens of the query.
+     *
+     * @param idx The index of the first token of the where clause. On
+     * return it is the index of the first token after the where clause.
+     *
+     * @param stopWords The keywords that end the where clause.
+     *
+     * @return The where clause with its conditions already reordered via
+     * the optimize() method.
+     *
+     * @exception Exp This method throws an exception if the where clause
+     * is not valid or is nested more than MaxDepth levels deep.
+     */
+    static WhereExpr parse(const CSV& csv, const StrVec& sql, size_t& idx,
+        const StrVec& stopWords = {});
+
+    /**
+     * Check if a given row satisfies this where clause. The conditions
+     * are checked in order and the check stops as soon as the outcome
+     * of an "and" or an "or" is known.
+     *
+     * @note The caller must hold the row's mutex.
+     *
+     * @param row The row to be checked.
+     *
+     * @return This method returns true if the row satisfies this clause.
+     */
+    bool matches(const CSVRow& row) const;
+
+    /**
+     * Check a set of rows (given as a selection vector) against this where
+     * clause and produce a selection vector with the rows that satisfy it.
+     * Predicates are evaluated using the SIMD kernels in Kernels.h. In an
+     * "and", each condition is only checked on the rows that satisfied
+     * the earlier conditions. In an "or", each condition is only checked
+     * on the rows that did not satisfy the earlier conditions.
+     *
+     * @note The caller must hold the mutexes of all the rows in the input.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param in The indices of the rows to be checked, in ascending order.
+     * At most kernels::ChunkSize rows can be checked in one call.
+     *
+     * @param inCount The number of entries in in.
+     *
+     * @param out The indices of the matching rows, in ascending order.
+     * This can be the same array as in.
+     *
+     * @return The number of entries written to out.
+     */
+    int filter(const CSV& csv, const int* in, const int inCount,
+        int* out) const;
+
+    /**
+     * Estimate the selectivity and cost of each node and reorder the
+     * children of "and" and "or" nodes. Children of an "and" are ordered
+     * so that cheap conditions that reject many rows are checked first,
+     * while the children of an "or" are ordered so that cheap conditions
+     * that accept many rows are checked first.
+     */
+    void optimize();
+
+    /**
+     * Convert a value in a CSV to a number, if possible.
+     *
+     * @param str The value to be converted.
+     *
+     * @return The value as a number. It is NaN if the whole string is
+     * not a valid number.
+     */
+    static double toNumber(const std::string& str);
+
+    /**
+     * Determine if this is an empty where clause that matches every row.
+     *
+     * @return This method returns true if the where clause is empty.
+     */
+    bool empty() const { return kind == Kind::NONE; }
+
+    /** The kind of this node in the expression tree */
+    Kind kind = Kind::NONE;
+
+    /** The condition of a predicate */
+    CondOp op = CondOp::INVALID;
+
+    /** The index of the column checked by a predicate */
+    int colIdx = -1;
+
+    /** The value to compare against in a predicate. For IN, this vector
+     * has all the values in the list. Otherwise it has just one value.
+     */
+    StrVec values;
+
+    /** The value of a range predicate as a number. It is NaN if the
+     * value is not a number, in which case strings are compared.
+     */
+    double number = 0;
+
+    /** The substring search prepared for a like predicate */
+    kernels::SubstrMatcher like;
+
+    /** The sub-expressions of an "and", "or", or "not" node */
+    std::vector<WhereExpr> children;
+
+    /** The estimated fraction of rows that satisfy this node */
+    double selectivity = 1;
+
+    /** The estimated relative cost of checking this node on a row */
+    double cost = 0;
+
+private:
+    /**
+     * Check if a single value satisfies the condition of a predicate.
+     *
+     * @param cell The value in the row to be checked.
+     *
+     * @return This method returns true if the condition is satisfied.
+     */
+    bool check(const std::string& cell) const;
+
+    /**
+     * Helper method to implement filter() for a predicate.
+     */
+    int filterPred(const CSV& csv, const int* in, const int inCount,
+        int* out) const;
+};
+
+#endif /* WHERE_EXPR_H */
@@ -60,6 +60,17 @@ function createInput() {
 function formatResponse(resp) {
     // Record the ending time.
     endTime = new Date().getMilliseconds();
+    // Results of select queries (and errors) are sent as JSON. Other
+    // responses are plain text messages.
+    var json = null;
+    try {
+        json = JSON.parse(resp);
+    } catch (e) {
+        json = null;
+    }
+    if (json !== null && typeof json === "object") {
+        return formatJson(json);
+    }
     // Split the multi-line response into an array for convenience
     var lines = resp.split("\n");
     // Remove any empty trailing lines.
@@ -98,6 +109,36 @@ function formatResponse(resp) {
     return tbl + msg;
 }
 
+/**
+ * This is a helper method that is used to format a JSON response from
+ * the AIRServer as an HTML table, in the same manner as formatResponse.
+ * 
+ * @param {object} json The parsed response from the server, with either
+ * the columns, rows, and count of rows selected or an error.
+ * 
+ * @returns {string} An HTML fragment with the response from the server
+ * nicely formatted.
+ */
+function formatJson(json) {
+    var elapsed = " (Elapsed time: " + (endTime - startTime) +
+            " milliseconds)</p>";
+    if (json.error !== undefined) {
+        return "<p class='error'>Error: " + json.error + elapsed;
+    }
+    var tbl = "";
+    if (json.count > 0) {
+        tbl += "<table class='air_table'>\n";
+        tbl += "<tr><th>" + json.columns.join("</th><th>") + "</th></tr>\n";
+        for (var i = 0; (i < json.rows.length); i++) {
+            tbl += "<tr><td>" + json.rows[i].join("</td><td>") +
+                    "</td></tr>\n";
+        }
+        tbl += "</table>\n";
+    }
+    return tbl + "<p class='message'>" + json.count + " row(s) selected." +
+            elapsed;
+}
+
 /**
  * Helper method to run a given command and also print the response when
  * it is received from the server. It sends the response as an Ajax call.
@@ -129,7 +170,7 @@ function run(cmd) {
         // Run the command.
         console.log("Running command: " + cmd);
         cmd = encodeURIComponent(cmd);
-        xhttp.open("GET", "../sql-air?query=" + cmd, false);
+        xhttp.open("GET", "../sql-air?query=" + cmd + "&format=json", false);
         // Save the tarting time.
         startTime = new Date().getMilliseconds();
         xhttp.send();